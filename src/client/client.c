@@ -1,22 +1,23 @@
+#include <errno.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/inotify.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <poll.h>
 #include <libgen.h>
 #include "client.h"
+#include <inttypes.h>
 #include <limits.h>
 #include "common/common.h"
 #include "common/protocol.h"
 #include "common/logging.h"
+#include "common/trace.h"
 
 
 // Logging configuration (overrides weak symbols from logging.c)
@@ -28,72 +29,38 @@ int get_log_facility(void) {
     return LOG_USER;
 }
 
+// Launches are silent unless something goes wrong: syslog isn't even opened. A warm
+// launch logs nothing, so this (and its getenv()) only runs once something is logged.
+int get_log_level(void) {
+    const char *verbose = getenv("WD_VERBOSE");
+    return verbose && verbose[0] != '\0' ? LOG_DEBUG : LOG_WARNING;
+}
+
+
+/**
+ * Create the message carrying the launch's request ID, so the daemon's spans can be matched with ours.
+ */
+static message_t *create_request_id_message(const uint64_t request_id) {
+    char id[32];
+    snprintf(id, sizeof(id), "%016" PRIx64, request_id);
+    return create_message(MSG_TRACE, id, STRLENGTH_WITH_NULL(id));
+}
 
 int main(const int argc, char *argv[]) {
+    trace_init("wdclient", TRACE_CLIENT_CAPACITY);
+    const uint64_t request_id = trace_request_id();
+    const uint64_t main_ns = trace_begin();
     if (argc < 2) {
         return fail("Missing command to execute\nUsage: %s <command...>", argv[0]);
     }
-    const char *socket_directory = client_get_socket_directory();
-    const char *socket_path = client_get_socket_path();
-    if (!socket_path) {
+    const struct sockaddr_un *socket_address = client_get_socket_address();
+    if (!socket_address) {
         return fail("Failed to get socket path");
     }
-    auto_close int sockfd = connect_to_daemon(socket_path);
-
-    if (sockfd < 0) {
-        log_info("Daemon not running. Starting daemon...");
-        // Starts the daemon if not running
-        // The daemon "knows" it's starting, it automatically
-        // Sends a READY message when initialized
-        if (start_daemon() != EXIT_SUCCESS)
-            return fail("Failed to start daemon");
-        int status;
-        // The socket might have created the socket too fast
-        // Ensure it doesn't exist before waiting for inotify
-        if (access(socket_path, F_OK)) status = wait_inotify(socket_directory);
-        else status = EXIT_SUCCESS;
-        if (status != EXIT_SUCCESS)
-            return fail("Failed to check for daemon socket");
-        int attempts = 0;
-        const int max_attempts = 5;
-        int delay_ms = 50;
-
-        while (attempts < max_attempts) {
-            sockfd = connect_to_daemon(socket_path);
-            if (sockfd >= 0) break;
-
-            log_debug("Connection attempt %d failed, retrying in %dms",
-                      attempts + 1, delay_ms);
-            usleep((useconds_t)delay_ms * 1000);
-            delay_ms *= 2;
-            attempts++;
-        }
-        if (sockfd < 0) {
-            return fail("Daemon socket not found after restart");
-        }
-        log_info("Daemon started.");
-    } else {
-        log_info("Connecting to existing daemon...");
-        // Alert the daemon that a new client has connected
-        // The daemon then acknowledges the message reception with a READY
-        auto_free_message message_t *hello_msg = create_message(MSG_HELLO, NULL, 0);
-        if (!hello_msg)
-            return fail("Failed to create HELLO message");
-        if (send_message(sockfd, hello_msg) != EXIT_SUCCESS)
-            return fail("Failed to send HELLO message");
-    }
-    log_info("Waypipe daemon's client started");
-    // Await for a READY message from the daemon
-    auto_free_message message_t *response = read_message(sockfd);
-    if (!response) {
-        return fail("Failed to read message from daemon");
-    }
-    if (response->header.type != MSG_READY) {
-        char buf[32];
-        get_message_type_string(response->header.type, buf, sizeof(buf));
-        return fail("Unexpected message type from daemon: %s", buf);
-    }
-    log_info("Connected to daemon successfully.");
+    if (argc == 2 && strcmp(argv[1], "--upgrade") == 0)
+        return upgrade_daemon(socket_address);
+    if (argc == 2 && strcmp(argv[1], "--stats") == 0)
+        return print_daemon_stats(socket_address);
 
     // 4096 characters is more than enough for 99.999% GUI app commands.
     // 1024 or 2048 could've been used, but this ensures 0.099% use case coverage
@@ -113,22 +80,61 @@ int main(const int argc, char *argv[]) {
         used += (size_t)ret;
     }
 
-    auto_free_message message_t* command = create_message(MSG_SEND, argument_string_buf,
+    // The whole request is built upfront, so it can go out in a single write
+    auto_free_message message_t *trace_msg = request_id ? create_request_id_message(request_id) : NULL;
+    auto_free_message message_t *hello_msg = create_message(MSG_HELLO, NULL, 0);
+    auto_free_message message_t *command = create_message(MSG_SEND, argument_string_buf,
                                                           STRLENGTH_WITH_NULL(argument_string_buf));
-    if (!command) {
+    if (!hello_msg || !command || (request_id && !trace_msg)) {
         return fail("Failed to create command message");
     }
-    if (send_message(sockfd, command) != EXIT_SUCCESS) {
+    trace_end("startup", request_id, main_ns);
+
+    uint64_t span_ns = trace_begin();
+    auto_close int sockfd = connect_to_daemon(socket_address);
+    trace_end("connect", request_id, span_ns);
+
+    if (sockfd < 0) {
+        log_info("Daemon not running. Starting daemon...");
+        span_ns = trace_begin();
+        sockfd = start_daemon(socket_address);
+        if (sockfd < 0)
+            return fail("Failed to start daemon");
+        log_info("Daemon started.");
+        trace_end("cold_start", request_id, span_ns);
+    }
+
+    // The daemon answers HELLO with READY then handles the command, no need to wait in between
+    span_ns = trace_begin();
+    const message_t *request[SEND_MESSAGES_MAX];
+    size_t request_count = 0;
+    if (trace_msg) request[request_count++] = trace_msg;
+    request[request_count++] = hello_msg;
+    request[request_count++] = command;
+    if (send_messages(sockfd, request, request_count) != EXIT_SUCCESS)
         return fail("Failed to send command message");
+
+    // Await for a READY message from the daemon
+    auto_free_message message_t *response = read_message(sockfd);
+    if (!response) {
+        return fail("Failed to read message from daemon");
+    }
+    if (response->header.type != MSG_READY) {
+        char buf[32];
+        get_message_type_string(response->header.type, buf, sizeof(buf));
+        return fail("Unexpected message type from daemon: %s", buf);
     }
-    log_info("Command sent to daemon: \"%s\"", argument_string_buf);
+    trace_end("handshake", request_id, span_ns);
+
+    span_ns = trace_begin();
     auto_free_message message_t *success_response = read_message(sockfd);
     if (!success_response)
         return fail("Failed to read success response from daemon");
     if (success_response->header.type != MSG_RESPONSE_OK)
         return fail("Daemon didn't receive the command successfully: %s",
                     success_response->header.length > 0 ? success_response->data : "(no message in error response)");
-    log_info("Command received by the daemon successfully.");
+    trace_end("request", request_id, span_ns);
+    trace_end("total", request_id, main_ns);
     closelog();
     return EXIT_SUCCESS;
 }
@@ -143,16 +149,27 @@ char *client_get_socket_directory(void) {
     return socket_directory;
 }
 
-char *client_get_socket_path(void) {
-    static char socket_path[SOCKET_PATH_MAX];
+const struct sockaddr_un *client_get_socket_address(void) {
+    static struct sockaddr_un addr;
     static bool initialized = false;
-    if (initialized) return socket_path;
+    if (initialized) return &addr;
     const char *socket_directory = client_get_socket_directory();
     if (!socket_directory) return NULL;
-    if (get_socket_path(socket_path, sizeof(socket_path), socket_directory) != EXIT_SUCCESS)
+    // Built in place once, every connection attempt reuses it
+    const size_t length = strlen(socket_directory);
+    if (length + 1 + sizeof(DAEMON_INT_SOCK) > sizeof(addr.sun_path))
         return NULL;
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, socket_directory, length);
+    addr.sun_path[length] = '/';
+    memcpy(addr.sun_path + length + 1, DAEMON_INT_SOCK, sizeof(DAEMON_INT_SOCK));
     initialized = true;
-    return socket_path;
+    return &addr;
+}
+
+const char *client_get_socket_path(void) {
+    const struct sockaddr_un *addr = client_get_socket_address();
+    return addr ? addr->sun_path : NULL;
 }
 
 int fail(const char *msg, ...) {
@@ -165,84 +182,72 @@ int fail(const char *msg, ...) {
 }
 
 
-int connect_to_daemon(const char *path) {
-    const int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+int connect_to_daemon(const struct sockaddr_un *addr) {
+    const int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (sockfd < 0) {
         perror("socket");
         return -1;
     }
-    struct sockaddr_un addr = {0};
-    addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, path, SOCKET_PATH_MAX - 1);
-    addr.sun_path[SOCKET_PATH_MAX - 1] = '\0';
-    if (connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("connect");
+    if (connect(sockfd, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        // No socket or a stale one: the daemon isn't running, which is expected
+        if (errno != ENOENT && errno != ECONNREFUSED) perror("connect");
         close(sockfd);
         return -1;
     }
     return sockfd;
 }
 
-int wait_inotify(const char *socket_directory) {
-    const auto_close int inotify_fd = inotify_init1(IN_CLOEXEC);
-    if (inotify_fd < 0) {
-        perror("inotify_init1");
-        return EXIT_FAILURE;
-    }
-    // Create the file path:
-    const int watch_fd = inotify_add_watch(inotify_fd, socket_directory, IN_CREATE);
-    if (watch_fd < 0) {
-        perror("inotify_add_watch");
-        return EXIT_FAILURE;
-    }
-    char event_buf[EVENT_SIZE * 64];
-    bool socket_found = false;
-    for (int retry = 0; retry <= MESSAGE_RECV_RETRIES*2 && !socket_found; retry++) {
-        struct pollfd pfd = {
-            .fd = inotify_fd,
-            .events = POLLIN
-        };
-        const int poll_ret = poll(&pfd, 1, MESSAGE_RECV_TIMEOUT_MS);
-        if (poll_ret < 0) {
-            perror("poll");
-            continue;
-        }
-        if (poll_ret == 0) {
-            log_debug("Inotify poll timeout, retrying... (%d/%d)", retry + 1, MESSAGE_RECV_RETRIES*2);
-            continue;
-        }
-        const ssize_t length = read(inotify_fd, event_buf, sizeof(event_buf));
-        if (length < 0) {
-            perror("read");
-            if (inotify_rm_watch(inotify_fd, watch_fd) < 0) {
-                log_debug("inotify_rm_watch failed"); // Despite being a system error, we only log it as debug since it's non-fatal
-            }
-            return EXIT_FAILURE;
-        }
-        for (ssize_t i = 0; i < length;) {
-            struct inotify_event event;
-            memcpy(&event, &event_buf[i], EVENT_SIZE);
-            // This is required to avoid reading from uninitialized memory
-            const char *name_ptr = &event_buf[i + (ssize_t)EVENT_SIZE];
-            if (event.len > 0 && event.mask & IN_CREATE && strncmp(name_ptr, DAEMON_INT_SOCK, event.len) == 0) {
-                log_info("Daemon socket created. Connecting...");
-                socket_found = true;
-                break;
-            }
-            i += (ssize_t)EVENT_SIZE + event.len;
-        }
-    }
-    if (inotify_rm_watch(inotify_fd, watch_fd) < 0) {
-        log_debug("inotify_rm_watch failed"); // Same as above, non-fatal
-    }
-    if (!socket_found) {
-        log_err("Daemon socket not found after %d retries.", MESSAGE_RECV_RETRIES*2);
-        return EXIT_FAILURE;
-    }
+int upgrade_daemon(const struct sockaddr_un *socket_address) {
+    const auto_close int sockfd = connect_to_daemon(socket_address);
+    if (sockfd < 0)
+        return fail("Daemon is not running");
+    auto_free_message message_t *hello_msg = create_message(MSG_HELLO, NULL, 0);
+    if (!hello_msg || send_message(sockfd, hello_msg) != EXIT_SUCCESS)
+        return fail("Failed to send HELLO message");
+    auto_free_message message_t *ready = read_message(sockfd);
+    if (!ready || ready->header.type != MSG_READY)
+        return fail("Daemon didn't acknowledge the connection");
+    auto_free_message message_t *upgrade_msg = create_message(MSG_UPGRADE, NULL, 0);
+    if (!upgrade_msg || send_message(sockfd, upgrade_msg) != EXIT_SUCCESS)
+        return fail("Failed to send UPGRADE message");
+    // Answered by the new executable once it has taken over
+    auto_free_message message_t *response = read_message(sockfd);
+    if (!response)
+        return fail("Failed to read upgrade response from daemon");
+    if (response->header.type != MSG_RESPONSE_OK)
+        return fail("Daemon upgrade failed: %s",
+                    response->header.length > 0 ? response->data : "(no message in error response)");
+    log_info("Daemon upgraded successfully.");
+    closelog();
+    return EXIT_SUCCESS;
+}
+
+int print_daemon_stats(const struct sockaddr_un *socket_address) {
+    const auto_close int sockfd = connect_to_daemon(socket_address);
+    if (sockfd < 0)
+        return fail("Daemon is not running");
+    auto_free_message message_t *hello_msg = create_message(MSG_HELLO, NULL, 0);
+    auto_free_message message_t *stats_msg = create_message(MSG_STATS, NULL, 0);
+    if (!hello_msg || !stats_msg)
+        return fail("Failed to create stats message");
+    const message_t *request[] = {hello_msg, stats_msg};
+    if (send_messages(sockfd, request, 2) != EXIT_SUCCESS)
+        return fail("Failed to send stats request");
+    auto_free_message message_t *ready = read_message(sockfd);
+    if (!ready || ready->header.type != MSG_READY)
+        return fail("Daemon didn't acknowledge the connection");
+    auto_free_message message_t *response = read_message(sockfd);
+    if (!response || response->header.type != MSG_RESPONSE_OK || response->header.length == 0)
+        return fail("Failed to read stats from daemon");
+    fputs(response->data, stdout);
+    closelog();
     return EXIT_SUCCESS;
 }
 
-int start_daemon(void) {
+/**
+ * Run wdaemon from the client's directory with the listening socket. Waits until it detached.
+ */
+static int spawn_daemon(const int listen_fd) {
     log_info("Starting daemon process...");
 
     const pid_t pid = fork();
@@ -268,6 +273,12 @@ int start_daemon(void) {
     }
 
     // Child process: prepare environment and exec the daemon
+    // Keep the socket clear of the standard streams replaced below
+    const int daemon_fd = listen_fd > STDERR_FILENO ? listen_fd : fcntl(listen_fd, F_DUPFD, STDERR_FILENO + 1);
+    if (daemon_fd < 0 || fcntl(daemon_fd, F_SETFD, 0) < 0) {
+        perror("fcntl");
+        exit(EXIT_FAILURE);
+    }
     const int devnull = open("/dev/null", O_RDWR);
     if (devnull < 0) {
         perror("open");
@@ -313,9 +324,33 @@ int start_daemon(void) {
         exit(EXIT_FAILURE);
     }
 
+    char fd_arg[16];
+    snprintf(fd_arg, sizeof(fd_arg), "%d", daemon_fd);
     log_debug("Executing daemon: %s", daemon_path);
-    execv(daemon_path, (char *const[]){"wdaemon", NULL});
+    execv(daemon_path, (char *const[]){"wdaemon", DAEMON_LISTEN_FD_ARG, fd_arg, NULL});
     // If execv returns, something went wrong
     perror("execv");
     exit(EXIT_FAILURE);
 }
+
+int start_daemon(const struct sockaddr_un *socket_address) {
+    const char *socket_directory = client_get_socket_directory();
+    if (!socket_directory) return -1;
+    // Serializes with other starting clients and with a daemon exiting while idle
+    const auto_close int lock_fd = lock_daemon(socket_directory);
+    if (lock_fd < 0) return -1;
+    // Another client may have started it while we waited for the lock
+    int sockfd = connect_to_daemon(socket_address);
+    if (sockfd >= 0) return sockfd;
+
+    const auto_close int listen_fd = create_listen_socket(socket_address->sun_path);
+    if (listen_fd < 0) return -1;
+    // Queued until the daemon accepts it
+    sockfd = connect_to_daemon(socket_address);
+    if (sockfd < 0 || spawn_daemon(listen_fd) != EXIT_SUCCESS) {
+        if (sockfd >= 0) close(sockfd);
+        unlink(socket_address->sun_path);
+        return -1;
+    }
+    return sockfd;
+}
@@ -9,44 +9,49 @@
 
 #ifndef WAYPIPEDAEMON_CLIENT_H
 #define WAYPIPEDAEMON_CLIENT_H
+#include <sys/un.h>
 #include "common/common.h"
 
 
 /**
- * @brief Size of an inotify event structure
+ * @brief Connect to the daemon socket.
  *
- * This defines a shorthand to access the size of an event from inotify.
+ * @param addr The address of the socket, see client_get_socket_address().
+ * @return The socket file descriptor, or -1 on error
  */
-#define EVENT_SIZE (sizeof(struct inotify_event))
-
+int connect_to_daemon(const struct sockaddr_un *addr);
 
 /**
- * @brief Connect to the socket at a given path.
+ * @brief Start the daemon and connect to it
  *
- * @param path The path to the socket.
- * @return The socket file descriptor, or -1 on error
+ * Holding the daemon lock, creates the daemon socket, connects to it and
+ * hands it over to a new daemon process. The connection waits in the
+ * listen backlog until the daemon accepts it, so there is nothing to wait
+ * for. If another client started the daemon meanwhile, connects to it instead.
+ *
+ * @param socket_address Address of the daemon socket
+ * @return The connected socket, or -1 on error
  */
-int connect_to_daemon(const char *path);
+int start_daemon(const struct sockaddr_un *socket_address);
 
 /**
- * @brief Wait for the inotify even signaling the socket creation.
- **
- * @brief Wait for the inotify even signaling the socket creation.
+ * @brief Ask the running daemon to re-exec its executable
  *
- * @param socket_directory The directory to watch for the socket creation.
- * @return 0 on success, -1 on error
+ * Used after installing a new build. The daemon keeps its socket and
+ * running applications, it's never started by this call.
+ *
+ * @param socket_address Address of the daemon socket
+ * @return EXIT_SUCCESS once the new executable answered, EXIT_FAILURE otherwise
  */
-int wait_inotify(const char *socket_directory);
+int upgrade_daemon(const struct sockaddr_un *socket_address);
 
 /**
- * @brief Start the daemon in a forked process
- *
- * Starts a subprocess that'll run the daemon.
- * The said daemon is responsible for the demonization.
+ * @brief Print the running daemon's resource usage to the standard output
  *
- * @return 0 on success, -1 on error
+ * @param socket_address Address of the daemon socket
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the daemon isn't running or didn't answer
  */
-int start_daemon(void);
+int print_daemon_stats(const struct sockaddr_un *socket_address);
 
 /**
  * @brief Handle a fatal error from the main
@@ -68,7 +73,17 @@ int fail(const char *msg, ...) format_func(printf, 1, 2);
  *
  * @return The socket path, or NULL on failure
  */
-char *client_get_socket_path(void);
+const char *client_get_socket_path(void);
+
+/**
+ * @brief Get the address of the daemon socket, built once and cached.
+ *
+ * @note Adapted to the single-threaded environment of the client.
+ * Do not attempt to use in a threaded environment.
+ *
+ * @return The socket address, or NULL on failure
+ */
+const struct sockaddr_un *client_get_socket_address(void);
 
 /**
  * @brief Get the directory path of the socket - adapted to the client.
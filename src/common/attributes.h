@@ -0,0 +1,17 @@
+#ifndef WAYPIPEDAEMON_ATTRIBUTES_H
+#define WAYPIPEDAEMON_ATTRIBUTES_H
+
+/**
+ * Compiler attribute shorthands shared by every header.
+ * Kept apart from common.h so that protocol.h can use them without
+ * creating an include cycle.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+    #define weak_func __attribute__((weak))
+    #define format_func(archetype, fmt_idx, args_idx) __attribute__((format(archetype, fmt_idx, args_idx)))
+    #define packed_struct __attribute__((packed))
+#else
+    #error "This code requires GCC or Clang"
+#endif
+
+#endif //WAYPIPEDAEMON_ATTRIBUTES_H
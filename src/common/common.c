@@ -1,6 +1,11 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/socket.h>
 #include "common.h"
 #include "protocol.h"
 #include "logging.h"
@@ -40,3 +45,80 @@ int get_socket_path(char *buffer, const size_t size, const char *dir) {
     log_debug("Socket path: %s", buffer);
     return EXIT_SUCCESS;
 }
+
+int lock_daemon(const char *dir) {
+    char path[SOCKET_PATH_MAX];
+    const int written = snprintf(path, sizeof(path), "%s/%s", dir, DAEMON_LOCK_FILE);
+    if (written < 0 || (size_t)written >= sizeof(path)) {
+        log_err("Lock path exceeds maximum length");
+        return -1;
+    }
+    const int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    while (flock(fd, LOCK_EX) < 0) {
+        if (errno == EINTR) continue;
+        perror("flock");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int create_listen_socket(const char *path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    if (unlink(path) < 0 && errno != ENOENT) {
+        perror("unlink");
+        return -1;
+    }
+
+    const int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(sockfd);
+        return -1;
+    }
+    if (listen(sockfd, DAEMON_LISTEN_BACKLOG) < 0) {
+        perror("listen");
+        close(sockfd);
+        unlink(path);
+        return -1;
+    }
+    return sockfd;
+}
+
+uint64_t hash_string(const char *string) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const unsigned char *p = (const unsigned char *)string; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
@@ -1,20 +1,34 @@
 #ifndef WAYPIPEDAEMON_COMMON_H
 #define WAYPIPEDAEMON_COMMON_H
 #include <sys/un.h>
+#include <stdint.h>
+#include "attributes.h"
 #include "protocol.h"
 #include <string.h>
 
 
 #define SOCKET_PATH_MAX (sizeof(((struct sockaddr_un*)0)->sun_path))
 #define DAEMON_INT_SOCK "waypipe-daemon.sock"
+/**
+ * Lock serializing the creation and removal of the daemon socket,
+ * so that a client starting the daemon never races one that is exiting.
+ */
+#define DAEMON_LOCK_FILE "waypipe-daemon.lock"
+#define DAEMON_LISTEN_BACKLOG 128
+/**
+ * Argument handing the listening socket created by the client over to the daemon it starts.
+ */
+#define DAEMON_LISTEN_FD_ARG "--listen-fd"
 #define STANDARD_BUFFER_SIZE 1024
 #define MESSAGE_RECV_TIMEOUT_MS 1000
 #define MESSAGE_RECV_RETRIES 5
+/**
+ * How long the daemon lets a client take for each step of the protocol.
+ * Matches the total time read_message() waits on the client side.
+ */
+#define CLIENT_TIMEOUT_MS (MESSAGE_RECV_TIMEOUT_MS * MESSAGE_RECV_RETRIES)
 #define STRLENGTH_WITH_NULL(str) (strlen(str) + 1)
 #if defined(__GNUC__) || defined(__clang__)
-    #define weak_func __attribute__((weak))
-    #define format_func(archetype, fmt_idx, args_idx) __attribute__((format(archetype, fmt_idx, args_idx)))
-    #define packed_struct __attribute__((packed))
     void close_ptr(const int *fd);
     void free_ptr(void **ptr);
     void free_message_ptr(message_t **msg);
@@ -45,4 +59,53 @@ int get_socket_directory(char *buffer, size_t size);
  */
 int get_socket_path(char *buffer, size_t size, const char *dir);
 
+/**
+ * Take the daemon lock of a socket directory, waiting for its holder.
+ *
+ * @param dir The socket directory
+ * @return The lock file descriptor (closing it releases the lock), or -1 on failure
+ */
+int lock_daemon(const char *dir);
+
+/**
+ * Create the daemon's listening socket, replacing any file at the path.
+ * Must be called with the daemon lock held, once the caller made sure no
+ * daemon answers on the path: the lock, not this function, decides who
+ * owns the socket.
+ *
+ * @param path Path of the socket
+ * @return The non-blocking listening socket, or -1 on failure
+ */
+int create_listen_socket(const char *path);
+
+/**
+ * Hash a string with FNV-1a, plenty for the short keys, commands and paths the daemon indexes.
+ * The history file stores these hashes: changing the function invalidates it.
+ *
+ * @param string The string
+ * @return The 64-bit hash
+ */
+uint64_t hash_string(const char *string);
+
+/**
+ * Get the current CLOCK_MONOTONIC time.
+ *
+ * @return Milliseconds since an arbitrary fixed point
+ */
+uint64_t monotonic_ms(void);
+
+/**
+ * Get the current CLOCK_MONOTONIC time with microsecond resolution.
+ *
+ * @return Microseconds since an arbitrary fixed point
+ */
+uint64_t monotonic_us(void);
+
+/**
+ * Get the current CLOCK_MONOTONIC time with nanosecond resolution.
+ *
+ * @return Nanoseconds since an arbitrary fixed point
+ */
+uint64_t monotonic_ns(void);
+
 #endif //WAYPIPEDAEMON_COMMON_H
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include "common.h"
 
 static atomic_bool g_logging_initialized = ATOMIC_VAR_INIT(false);
+// get_log_level() always returns the same value: threads racing to cache it store the same level
+static atomic_int g_log_level = ATOMIC_VAR_INIT(-1);
 
 /**
  * Weak default implementation - returns "waypipe"
@@ -23,11 +25,25 @@ weak_func int get_log_facility(void) {
     return LOG_LOCAL0;
 }
 
+/**
+ * Weak default implementation - returns LOG_DEBUG
+ * Override where needed with a strong symbol
+ */
+weak_func int get_log_level(void) {
+    return LOG_DEBUG;
+}
+
 void openlog_name(const char *name) {
     openlog(name, LOG_PID | LOG_PERROR, get_log_facility());
 }
 
 void vlog_impl(const int level, const char *fmt, va_list args) {
+    int max_level = atomic_load(&g_log_level);
+    if (max_level < 0) {
+        max_level = get_log_level();
+        atomic_store(&g_log_level, max_level);
+    }
+    if (level > max_level) return;
     bool expected = false;
     if (atomic_compare_exchange_strong(&g_logging_initialized, &expected, true)) {
         openlog_name(get_log_name());
@@ -36,6 +36,16 @@ const char *get_log_name(void);
  */
 int get_log_facility(void);
 
+/**
+ * Get the least severe level logged by this binary.
+ * Override this function in your binary to drop verbose messages before
+ * they are formatted; syslog is only opened by the first message kept.
+ * Default: LOG_DEBUG (everything)
+ *
+ * @return The syslog level (e.g., LOG_WARNING)
+ */
+int get_log_level(void);
+
 void openlog_name(const char *name);
 
 void vlog_impl(int level, const char *fmt, va_list args) format_func(printf, 2, 0);
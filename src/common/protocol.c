@@ -1,9 +1,11 @@
 #include "protocol.h"
 #include <stdlib.h>
 #include <string.h>
-#include <inttypes.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <poll.h>
 #include <arpa/inet.h>
 
@@ -19,6 +21,12 @@ void get_message_type_string(const message_type_t type, char *buf, const size_t
         break;
     case MSG_SEND: name = "MSG_SEND";
         break;
+    case MSG_UPGRADE: name = "MSG_UPGRADE";
+        break;
+    case MSG_TRACE: name = "MSG_TRACE";
+        break;
+    case MSG_STATS: name = "MSG_STATS";
+        break;
     case MSG_RESPONSE_OK: name = "MSG_RESPONSE_OK";
         break;
     case MSG_RESPONSE_ERROR: name = "MSG_RESPONSE_ERROR";
@@ -41,7 +49,6 @@ message_t *create_message(const message_type_t type, const char *data, const siz
     msg->header.type = UINT8(type);
     msg->header.length = (uint16_t)length;
     if (data) memcpy(msg->data, data, length);
-    log_debug("Allocating message with type: %" PRIu32, msg->header.type);
     return msg;
 }
 
@@ -83,7 +90,24 @@ message_t *read_message(const int sockfd) {
         return NULL;
     }
     msg->header = header;
-    if (header.length > 0) {
+    // The payload usually arrives with its header: only poll when it isn't there yet
+    size_t received = 0;
+    while (received < header.length) {
+        length = recv(sockfd, msg->data + received, header.length - received, MSG_DONTWAIT);
+        if (length > 0) {
+            received += (size_t)length;
+            continue;
+        }
+        if (length == 0) {
+            free_message(msg);
+            log_err("Incomplete message data");
+            return NULL;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("recv");
+            free_message(msg);
+            return NULL;
+        }
         for (int retry = 0; retry < MESSAGE_RECV_RETRIES; retry++) {
             poll_ret = poll(&pfd, 1, MESSAGE_RECV_TIMEOUT_MS);
             if (poll_ret > 0) break;  // Data available
@@ -94,65 +118,126 @@ message_t *read_message(const int sockfd) {
             }
             // poll_ret == 0 (timeout), continue retrying
         }
-
         if (poll_ret == 0) {
             log_err("Timeout waiting for message data after %d retries", MESSAGE_RECV_RETRIES);
             free_message(msg);
             return NULL;
         }
+    }
+    if (header.length > 0 && msg->data[header.length - 1] != '\0') {
+        free_message(msg);
+        log_err("Message data does not end with a null terminator");
+        return NULL;
+    }
+    return msg;
+}
+
+void message_reader_init(message_reader_t *reader) {
+    memset(reader, 0, sizeof(*reader));
+}
+
+void message_reader_reset(message_reader_t *reader) {
+    free_message(reader->msg);
+    message_reader_init(reader);
+}
+
+/**
+ * Receive up to size bytes without blocking.
+ * Returns the number of bytes read, 0 if the call would block,
+ * or -1 on error/close (closed is reported through *closed).
+ */
+static ssize_t recv_available(const int sockfd, void *buf, const size_t size, bool *closed) {
+    const ssize_t length = recv(sockfd, buf, size, MSG_DONTWAIT);
+    if (length == 0) {
+        *closed = true;
+        return -1;
+    }
+    if (length < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+        return -1;
+    }
+    return length;
+}
 
-        length = recv(sockfd, msg->data, header.length, MSG_WAITALL);
+message_reader_status_t message_reader_feed(message_reader_t *reader, const int sockfd, message_t **out) {
+    bool closed = false;
+    *out = NULL;
+    while (reader->header_received < sizeof(message_header_t)) {
+        const ssize_t length = recv_available(sockfd, (char *)&reader->header + reader->header_received,
+                                              sizeof(message_header_t) - reader->header_received, &closed);
         if (length < 0) {
-            perror("recv");
-            free_message(msg);
-            return NULL;
+            // A close in the middle of a header is a truncated message, not a clean close
+            if (closed && reader->header_received == 0) return MESSAGE_READER_CLOSED;
+            log_debug("Failed to receive message header");
+            return MESSAGE_READER_ERROR;
         }
-        if (length < header.length) {
-            free_message(msg);
-            log_err("Incomplete message data");
-            return NULL;
+        if (length == 0) return MESSAGE_READER_AGAIN;
+        reader->header_received += (size_t)length;
+        if (reader->header_received < sizeof(message_header_t)) continue;
+        reader->header.length = ntohs(reader->header.length);
+        reader->msg = malloc(sizeof(message_header_t) + reader->header.length);
+        if (!reader->msg) {
+            perror("malloc");
+            return MESSAGE_READER_ERROR;
         }
-        if (msg->data[header.length - 1] != '\0') {
-            free_message(msg);
-            log_err("Message data does not end with a null terminator");
-            return NULL;
+        reader->msg->header = reader->header;
+    }
+    while (reader->data_received < reader->header.length) {
+        const ssize_t length = recv_available(sockfd, reader->msg->data + reader->data_received,
+                                              reader->header.length - reader->data_received, &closed);
+        if (length < 0) {
+            log_debug("Failed to receive message data");
+            return MESSAGE_READER_ERROR;
         }
+        if (length == 0) return MESSAGE_READER_AGAIN;
+        reader->data_received += (size_t)length;
     }
-    return msg;
+    if (reader->header.length > 0 && reader->msg->data[reader->header.length - 1] != '\0') {
+        log_err("Message data does not end with a null terminator");
+        return MESSAGE_READER_ERROR;
+    }
+    *out = reader->msg;
+    reader->msg = NULL;
+    message_reader_init(reader);
+    return MESSAGE_READER_DONE;
 }
 
 int send_message(const int sockfd, const message_t *msg) {
-    message_header_t header_net = {
-        .type = msg->header.type,
-        .length = htons(msg->header.length)
-    };
-    ssize_t length = send(sockfd, &header_net, sizeof(message_header_t), MSG_NOSIGNAL);
+    return send_messages(sockfd, &msg, 1);
+}
+
+int send_messages(const int sockfd, const message_t *const *msgs, const size_t count) {
+    if (count == 0 || count > SEND_MESSAGES_MAX) return EXIT_FAILURE;
+    // Headers go on the wire in network byte order, payloads as they are
+    message_header_t headers[SEND_MESSAGES_MAX];
+    struct iovec iov[SEND_MESSAGES_MAX * 2];
+    size_t iov_count = 0;
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        headers[i] = (message_header_t){
+            .type = msgs[i]->header.type,
+            .length = htons(msgs[i]->header.length)
+        };
+        iov[iov_count++] = (struct iovec){.iov_base = &headers[i], .iov_len = sizeof(message_header_t)};
+        if (msgs[i]->header.length > 0)
+            iov[iov_count++] = (struct iovec){.iov_base = (void *)msgs[i]->data, .iov_len = msgs[i]->header.length};
+        total += sizeof(message_header_t) + msgs[i]->header.length;
+    }
+    const struct msghdr header = {.msg_iov = iov, .msg_iovlen = iov_count};
+    const ssize_t length = sendmsg(sockfd, &header, MSG_NOSIGNAL);
     if (length < 0) {
-        perror("send");
+        perror("sendmsg");
         return EXIT_FAILURE;
     }
-    if (length < (ssize_t)sizeof(message_header_t)) {
-        log_err("Incomplete message header sent");
+    if ((size_t)length < total) {
+        log_err("Incomplete message sent");
         return EXIT_FAILURE;
     }
-    // If data is present
-    if (msg->header.length > 0) {
-        length = send(sockfd, msg->data, msg->header.length, MSG_NOSIGNAL);
-        if (length < 0) {
-            perror("send");
-            return EXIT_FAILURE;
-        }
-        if (length < msg->header.length) {
-            log_err("Incomplete message data sent");
-            return EXIT_FAILURE;
-        }
-    }
     return EXIT_SUCCESS;
 }
 
 void free_message(message_t *msg) {
     if (!msg) return;
-    log_debug("Freeing message with type: %" PRIu32, msg->header.type);
     free(msg);
 }
 
@@ -11,6 +11,7 @@
 #define WAYPIPEDAEMON_PROTOCOL_H
 #include <stddef.h>
 #include <stdint.h>
+#include "attributes.h"
 
 /**
  * @brief Maximum size of a message in bytes (65 KB)
@@ -41,6 +42,9 @@ typedef enum {
     MSG_HELLO = 1,          /**< Initial handshake message from a client */
     MSG_READY = 2,          /**< Server ready acknowledgment */
     MSG_SEND = 3,           /**< Data transmission message */
+    MSG_UPGRADE = 4,        /**< Ask the daemon to re-exec its (possibly updated) executable */
+    MSG_TRACE = 5,          /**< Request ID of the launch, in hex; only sent when tracing */
+    MSG_STATS = 6,          /**< Ask for the daemon's resource usage, answered with text lines */
     MSG_RESPONSE_OK = 100,  /**< Success response */
     MSG_RESPONSE_ERROR = 101 /**< Error response */
 } message_type_t;
@@ -57,6 +61,30 @@ typedef struct packed_struct {
     char data[];              /**< Variable-length payload data */
 } message_t;
 
+/**
+ * @brief Result of feeding a non-blocking socket into a message reader
+ */
+typedef enum {
+    MESSAGE_READER_AGAIN = 0,  /**< More bytes are needed, wait for the socket to become readable */
+    MESSAGE_READER_DONE,       /**< A complete message has been returned */
+    MESSAGE_READER_CLOSED,     /**< The peer closed the connection */
+    MESSAGE_READER_ERROR       /**< Socket error or malformed message */
+} message_reader_status_t;
+
+/**
+ * @brief Incremental reader for the message framing on non-blocking sockets
+ *
+ * read_message() blocks until a whole message arrives, which is fine for the
+ * short-lived client but would let a single slow peer stall an event loop.
+ * The reader keeps the partial header/payload between calls instead.
+ */
+typedef struct {
+    message_header_t header;  /**< Header being assembled (host byte order once complete) */
+    size_t header_received;   /**< Number of header bytes received so far */
+    message_t *msg;           /**< Message being filled once the header is complete */
+    size_t data_received;     /**< Number of payload bytes received so far */
+} message_reader_t;
+
 /**
  * @brief Convert a message type to its string representation
  *
@@ -92,6 +120,36 @@ message_t *create_message(message_type_t type, const char *data, size_t length);
  */
 message_t *read_message(int sockfd);
 
+/**
+ * @brief Initialize a message reader
+ *
+ * @param reader The reader to initialize
+ */
+void message_reader_init(message_reader_t *reader);
+
+/**
+ * @brief Release any partially received message held by a reader
+ *
+ * The reader is left initialized and can be reused.
+ *
+ * @param reader The reader to reset
+ */
+void message_reader_reset(message_reader_t *reader);
+
+/**
+ * @brief Read as much of the next message as is available without blocking
+ *
+ * Only the bytes belonging to the current message are consumed, so pipelined
+ * messages stay in the socket buffer for the next call.
+ *
+ * @param reader The reader holding the partial message
+ * @param sockfd Non-blocking socket file descriptor to read from
+ * @param out Set to the complete message when MESSAGE_READER_DONE is returned.
+ *            The caller owns it and must free it with free_message().
+ * @return The reader status
+ */
+message_reader_status_t message_reader_feed(message_reader_t *reader, int sockfd, message_t **out);
+
 /**
  * @brief Send a message through a socket
  *
@@ -104,6 +162,24 @@ message_t *read_message(int sockfd);
  */
 int send_message(int sockfd, const message_t *msg);
 
+/**
+ * @brief Maximum number of messages sent together by send_messages()
+ */
+#define SEND_MESSAGES_MAX 4
+
+/**
+ * @brief Send several messages through a socket in a single write
+ *
+ * Pipelining saves a round trip when the peer's answer to the first
+ * message isn't needed to build the next ones (e.g. HELLO then SEND).
+ *
+ * @param sockfd Socket file descriptor to write to
+ * @param msgs Messages to send, in order
+ * @param count Number of messages, at most SEND_MESSAGES_MAX
+ * @return 0 on success, -1 on error
+ */
+int send_messages(int sockfd, const message_t *const *msgs, size_t count);
+
 /**
  * @brief Free memory allocated for a message
  *
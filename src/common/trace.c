@@ -0,0 +1,91 @@
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "logging.h"
+
+bool trace_enabled = false;
+static trace_file_t *trace_file = NULL;
+static size_t trace_size = 0;
+
+void trace_init(const char *process, const uint32_t capacity) {
+    const char *directory = getenv(TRACE_ENV);
+    if (!directory || directory[0] == '\0' || capacity == 0 || trace_file) return;
+    if (mkdir(directory, 0700) < 0 && errno != EEXIST) {
+        log_warning("Tracing disabled, failed to create %s: %s", directory, strerror(errno));
+        return;
+    }
+    char path[PATH_MAX];
+    const int pid = (int)getpid();
+    const int written = snprintf(path, sizeof(path), "%s/%s.%d%s", directory, process, pid, TRACE_FILE_SUFFIX);
+    if (written < 0 || (size_t)written >= sizeof(path)) {
+        log_warning("Tracing disabled, trace directory path too long");
+        return;
+    }
+    const auto_close int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log_warning("Tracing disabled, failed to open %s: %s", path, strerror(errno));
+        return;
+    }
+    const size_t size = sizeof(trace_file_t) + (size_t)capacity * sizeof(trace_record_t);
+    if (ftruncate(fd, (off_t)size) < 0) {
+        perror("ftruncate");
+        return;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    trace_file = map;
+    trace_size = size;
+    // Keep the spans of a previous executable of this process, see upgrade.h
+    if (trace_file->magic != TRACE_MAGIC || trace_file->version != TRACE_VERSION ||
+        trace_file->capacity != capacity || trace_file->pid != pid) {
+        memset(trace_file, 0, size);
+        trace_file->magic = TRACE_MAGIC;
+        trace_file->version = TRACE_VERSION;
+        trace_file->capacity = capacity;
+        trace_file->pid = pid;
+        snprintf(trace_file->process, sizeof(trace_file->process), "%s", process);
+    }
+    trace_enabled = true;
+}
+
+void trace_close(void) {
+    trace_enabled = false;
+    if (trace_file) munmap(trace_file, trace_size);
+    trace_file = NULL;
+    trace_size = 0;
+}
+
+static uint32_t request_sequence = 0;
+
+uint64_t trace_request_id(void) {
+    if (!trace_enabled) return 0;
+    return (uint64_t)(uint32_t)getpid() << 32 | ++request_sequence;
+}
+
+uint32_t trace_request_sequence(void) {
+    return request_sequence;
+}
+
+void trace_resume_request_ids(const uint32_t sequence) {
+    request_sequence = sequence;
+}
+
+void trace_record(const char *name, const uint64_t request_id, const uint64_t start_ns, const uint64_t end_ns) {
+    if (!trace_file) return;
+    trace_record_t *record = &trace_file->records[trace_file->next % trace_file->capacity];
+    record->request_id = request_id;
+    record->start_ns = start_ns;
+    record->end_ns = end_ns;
+    snprintf(record->name, sizeof(record->name), "%s", name);
+    trace_file->next++;
+}
@@ -0,0 +1,135 @@
+/**
+ * @file trace.h
+ * @brief Launch tracing shared by wdclient and wdaemon
+ *
+ * When WD_TRACE names a directory, each process records timed spans into
+ * its own memory-mapped ring, `<directory>/<process>.<pid>.trace`. A span
+ * carries the ID of the launch request it belongs to; the client sends that
+ * ID to the daemon (MSG_TRACE), so spans of both processes can be matched.
+ * wdtrace converts the files to the Chrome trace JSON format.
+ *
+ * When WD_TRACE is unset, trace_begin()/trace_end() only test a flag.
+ */
+
+#ifndef WAYPIPEDAEMON_TRACE_H
+#define WAYPIPEDAEMON_TRACE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+#define TRACE_ENV "WD_TRACE"
+#define TRACE_FILE_SUFFIX ".trace"
+#define TRACE_MAGIC 0x31544457u  /* "WDT1" */
+#define TRACE_VERSION 1u
+#define TRACE_NAME_MAX 40
+#define TRACE_PROCESS_MAX 16
+/**
+ * @brief Ring sizes: a client records a handful of spans, the daemon runs for days
+ */
+#define TRACE_CLIENT_CAPACITY 64u
+#define TRACE_DAEMON_CAPACITY 65536u
+
+/**
+ * @brief One timed span
+ */
+typedef struct {
+    uint64_t request_id;         /**< Launch request the span belongs to, 0 for none */
+    uint64_t start_ns;           /**< CLOCK_MONOTONIC start, 0 for an unused record */
+    uint64_t end_ns;             /**< CLOCK_MONOTONIC end */
+    char name[TRACE_NAME_MAX];   /**< Stage name, possibly truncated */
+} trace_record_t;
+
+_Static_assert(sizeof(trace_record_t) == 64, "trace records must stay 64 bytes");
+
+/**
+ * @brief Layout of a trace file
+ */
+typedef struct {
+    uint32_t magic;                    /**< TRACE_MAGIC */
+    uint32_t version;                  /**< TRACE_VERSION */
+    uint32_t capacity;                 /**< Number of records */
+    int32_t pid;                       /**< Process that wrote the file */
+    uint64_t next;                     /**< Total number of spans recorded, the ring index is next % capacity */
+    char process[TRACE_PROCESS_MAX];   /**< Process name */
+    trace_record_t records[];          /**< Ring of spans */
+} trace_file_t;
+
+/**
+ * @brief Whether tracing is on, read by the inline helpers
+ */
+extern bool trace_enabled;
+
+/**
+ * @brief Start tracing if WD_TRACE is set
+ *
+ * Reuses the file of a previous executable with the same PID (after a
+ * daemon upgrade). Tracing stays off on any failure.
+ *
+ * @param process Process name, stored in the file
+ * @param capacity Number of spans kept
+ */
+void trace_init(const char *process, uint32_t capacity);
+
+/**
+ * @brief Stop tracing and unmap the file
+ */
+void trace_close(void);
+
+/**
+ * @brief Make a request ID unique across processes
+ *
+ * The ID is the PID followed by a per-process sequence number.
+ *
+ * @return A new non-zero ID, or 0 when tracing is off
+ */
+uint64_t trace_request_id(void);
+
+/**
+ * @brief Get the sequence number of the last request ID
+ *
+ * A daemon upgrade keeps the PID, so the new executable must go on from
+ * where the previous one stopped, see trace_resume_request_ids().
+ *
+ * @return The sequence number of the last ID made by trace_request_id()
+ */
+uint32_t trace_request_sequence(void);
+
+/**
+ * @brief Go on with request IDs after those of a previous executable
+ *
+ * @param sequence The value of trace_request_sequence() in the previous executable
+ */
+void trace_resume_request_ids(uint32_t sequence);
+
+/**
+ * @brief Append a span to the trace file
+ *
+ * @param name Stage name
+ * @param request_id Request the span belongs to, or 0
+ * @param start_ns CLOCK_MONOTONIC start
+ * @param end_ns CLOCK_MONOTONIC end
+ */
+void trace_record(const char *name, uint64_t request_id, uint64_t start_ns, uint64_t end_ns);
+
+/**
+ * @brief Start a span
+ *
+ * @return The start time, or 0 when tracing is off
+ */
+static inline uint64_t trace_begin(void) {
+    return trace_enabled ? monotonic_ns() : 0;
+}
+
+/**
+ * @brief End a span started by trace_begin()
+ *
+ * @param name Stage name
+ * @param request_id Request the span belongs to, or 0
+ * @param start_ns Value returned by trace_begin()
+ */
+static inline void trace_end(const char *name, const uint64_t request_id, const uint64_t start_ns) {
+    if (trace_enabled && start_ns != 0) trace_record(name, request_id, start_ns, monotonic_ns());
+}
+
+#endif //WAYPIPEDAEMON_TRACE_H
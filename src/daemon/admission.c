@@ -0,0 +1,134 @@
+#include "admission.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t bucket_capacity(const launch_limits_t *limits) {
+    return (uint64_t)(limits->burst > 0 ? limits->burst : 1) * 1000u;
+}
+
+static void bucket_fill(token_bucket_t *bucket, const launch_limits_t *limits, const uint64_t now_ms) {
+    bucket->tokens = bucket_capacity(limits);
+    bucket->updated_ms = now_ms;
+}
+
+/**
+ * Refill a bucket and return how long until it holds a whole token (0 if it does).
+ * A rate of 0 disables the bucket.
+ */
+static uint32_t bucket_wait_ms(token_bucket_t *bucket, const launch_limits_t *limits, const uint64_t now_ms) {
+    if (limits->rate == 0) return 0;
+    const uint64_t capacity = bucket_capacity(limits);
+    if (now_ms > bucket->updated_ms) {
+        // rate tokens per second is rate thousandths of a token per millisecond
+        bucket->tokens += (now_ms - bucket->updated_ms) * limits->rate;
+        if (bucket->tokens > capacity) bucket->tokens = capacity;
+        bucket->updated_ms = now_ms;
+    }
+    if (bucket->tokens >= 1000u) return 0;
+    return (uint32_t)((1000u - bucket->tokens + limits->rate - 1) / limits->rate);
+}
+
+static void bucket_take(token_bucket_t *bucket, const launch_limits_t *limits) {
+    if (limits->rate > 0) bucket->tokens -= 1000u;
+}
+
+static bool inflight_full(const unsigned int inflight, const launch_limits_t *limits) {
+    return limits->max_inflight > 0 && inflight >= limits->max_inflight;
+}
+
+void admission_init(admission_t *admission, const launch_limits_t *peer_limits, const launch_limits_t *global_limits) {
+    memset(admission, 0, sizeof(*admission));
+    admission->peer_limits = *peer_limits;
+    admission->global_limits = *global_limits;
+    bucket_fill(&admission->global_bucket, global_limits, 0);
+}
+
+static void bucket_cap(token_bucket_t *bucket, const launch_limits_t *limits) {
+    if (bucket->tokens > bucket_capacity(limits)) bucket->tokens = bucket_capacity(limits);
+}
+
+void admission_set_limits(admission_t *admission, const launch_limits_t *peer_limits,
+                          const launch_limits_t *global_limits) {
+    admission->peer_limits = *peer_limits;
+    admission->global_limits = *global_limits;
+    bucket_cap(&admission->global_bucket, global_limits);
+    for (admission_peer_t *peer = admission->peers; peer; peer = peer->next) bucket_cap(&peer->bucket, peer_limits);
+}
+
+/**
+ * Forget peers with nothing in flight and a full bucket; they would be
+ * recreated in exactly the same state.
+ */
+static void prune_idle_peers(admission_t *admission, const uint64_t now_ms) {
+    for (admission_peer_t **link = &admission->peers; *link;) {
+        admission_peer_t *peer = *link;
+        bucket_wait_ms(&peer->bucket, &admission->peer_limits, now_ms);
+        if (peer->inflight == 0 && peer->bucket.tokens >= bucket_capacity(&admission->peer_limits)) {
+            *link = peer->next;
+            free(peer);
+            admission->peer_count--;
+        } else {
+            link = &peer->next;
+        }
+    }
+}
+
+static admission_peer_t *get_peer(admission_t *admission, const uid_t uid, const uint64_t now_ms) {
+    for (admission_peer_t *peer = admission->peers; peer; peer = peer->next) {
+        if (peer->uid == uid) return peer;
+    }
+    if (admission->peer_count >= ADMISSION_MAX_IDLE_PEERS) prune_idle_peers(admission, now_ms);
+    admission_peer_t *peer = calloc(1, sizeof(admission_peer_t));
+    if (!peer) {
+        perror("calloc");
+        return NULL;
+    }
+    peer->uid = uid;
+    bucket_fill(&peer->bucket, &admission->peer_limits, now_ms);
+    peer->next = admission->peers;
+    admission->peers = peer;
+    admission->peer_count++;
+    return peer;
+}
+
+uint32_t admission_acquire(admission_t *admission, const uid_t uid, const uint64_t now_ms) {
+    admission_peer_t *peer = get_peer(admission, uid, now_ms);
+    if (!peer) return ADMISSION_INFLIGHT_RETRY_MS;
+    if (inflight_full(peer->inflight, &admission->peer_limits) ||
+        inflight_full(admission->global_inflight, &admission->global_limits))
+        return ADMISSION_INFLIGHT_RETRY_MS;
+
+    // Only take tokens once both buckets can give one
+    const uint32_t peer_wait = bucket_wait_ms(&peer->bucket, &admission->peer_limits, now_ms);
+    const uint32_t global_wait = bucket_wait_ms(&admission->global_bucket, &admission->global_limits, now_ms);
+    if (peer_wait > 0 || global_wait > 0) return peer_wait > global_wait ? peer_wait : global_wait;
+    bucket_take(&peer->bucket, &admission->peer_limits);
+    bucket_take(&admission->global_bucket, &admission->global_limits);
+    peer->inflight++;
+    admission->global_inflight++;
+    return 0;
+}
+
+void admission_release(admission_t *admission, const uid_t uid) {
+    for (admission_peer_t *peer = admission->peers; peer; peer = peer->next) {
+        if (peer->uid != uid) continue;
+        if (peer->inflight > 0) peer->inflight--;
+        break;
+    }
+    if (admission->global_inflight > 0) admission->global_inflight--;
+}
+
+void admission_trim(admission_t *admission, const uint64_t now_ms) {
+    prune_idle_peers(admission, now_ms);
+}
+
+void admission_free(admission_t *admission) {
+    while (admission->peers) {
+        admission_peer_t *next = admission->peers->next;
+        free(admission->peers);
+        admission->peers = next;
+    }
+    admission->peer_count = 0;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file admission.h
+ * @brief Launch admission control
+ *
+ * Every launch that would spawn a process takes a token from its peer's
+ * bucket and from the global one, and counts as in flight until its client
+ * gets an answer. A launch over either limit is refused with a retry hint
+ * instead of being queued, so a runaway script can't starve other clients.
+ */
+
+#ifndef WAYPIPEDAEMON_ADMISSION_H
+#define WAYPIPEDAEMON_ADMISSION_H
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "config.h"
+
+/**
+ * @brief Retry hint given when a launch is refused for too many in-flight launches
+ */
+#define ADMISSION_INFLIGHT_RETRY_MS 100
+/**
+ * @brief Number of tracked peers above which idle ones are forgotten
+ */
+#define ADMISSION_MAX_IDLE_PEERS 32
+
+/**
+ * @brief Token bucket in thousandths of a token
+ */
+typedef struct {
+    uint64_t tokens;      /**< Available tokens, times 1000 */
+    uint64_t updated_ms;  /**< CLOCK_MONOTONIC time of the last refill */
+} token_bucket_t;
+
+/**
+ * @brief Admission state of one peer UID
+ */
+typedef struct admission_peer {
+    uid_t uid;                    /**< Peer UID from SO_PEERCRED */
+    token_bucket_t bucket;        /**< Launch rate bucket */
+    unsigned int inflight;        /**< Admitted launches not answered yet */
+    struct admission_peer *next;  /**< Next tracked peer */
+} admission_peer_t;
+
+/**
+ * @brief Admission state of the daemon
+ */
+typedef struct {
+    launch_limits_t peer_limits;    /**< Limits applied to each peer */
+    launch_limits_t global_limits;  /**< Limits applied to all peers together */
+    token_bucket_t global_bucket;   /**< Global launch rate bucket */
+    unsigned int global_inflight;   /**< Admitted launches not answered yet, all peers */
+    admission_peer_t *peers;        /**< Tracked peers */
+    size_t peer_count;              /**< Number of tracked peers */
+} admission_t;
+
+/**
+ * @brief Initialize the admission state with full buckets
+ *
+ * @param admission The admission state
+ * @param peer_limits Limits applied to each peer
+ * @param global_limits Limits applied to all peers together
+ */
+void admission_init(admission_t *admission, const launch_limits_t *peer_limits, const launch_limits_t *global_limits);
+
+/**
+ * @brief Change the limits, keeping the launches in flight and the tokens left
+ *
+ * Buckets holding more tokens than the new burst allows are capped.
+ *
+ * @param admission The admission state
+ * @param peer_limits Limits applied to each peer
+ * @param global_limits Limits applied to all peers together
+ */
+void admission_set_limits(admission_t *admission, const launch_limits_t *peer_limits,
+                          const launch_limits_t *global_limits);
+
+/**
+ * @brief Try to admit a launch
+ *
+ * On success the launch is counted as in flight until admission_release().
+ *
+ * @param admission The admission state
+ * @param uid Peer UID of the client
+ * @param now_ms Current CLOCK_MONOTONIC time
+ * @return 0 if admitted, otherwise a hint of how many milliseconds to wait before retrying
+ */
+uint32_t admission_acquire(admission_t *admission, uid_t uid, uint64_t now_ms);
+
+/**
+ * @brief Mark an admitted launch as answered
+ *
+ * @param admission The admission state
+ * @param uid Peer UID given to admission_acquire()
+ */
+void admission_release(admission_t *admission, uid_t uid);
+
+/**
+ * @brief Forget the peers that hold no state, to release memory while idle
+ *
+ * @param admission The admission state
+ * @param now_ms Current CLOCK_MONOTONIC time in milliseconds
+ */
+void admission_trim(admission_t *admission, uint64_t now_ms);
+
+/**
+ * @brief Free the tracked peers
+ *
+ * @param admission The admission state
+ */
+void admission_free(admission_t *admission);
+
+#endif //WAYPIPEDAEMON_ADMISSION_H
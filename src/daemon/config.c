@@ -0,0 +1,381 @@
+#include "config.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common/common.h"
+#include "common/logging.h"
+#include "matcher.h"
+
+int get_config_path(char *buffer, const size_t size) {
+    const char *config_home = getenv("XDG_CONFIG_HOME");
+    int written;
+    if (config_home && config_home[0] != '\0') {
+        written = snprintf(buffer, size, "%s/%s/%s", config_home, CONFIG_DIR_NAME, CONFIG_FILE_NAME);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home || home[0] == '\0') {
+            log_err("Neither XDG_CONFIG_HOME nor HOME is set");
+            return EXIT_FAILURE;
+        }
+        written = snprintf(buffer, size, "%s/.config/%s/%s", home, CONFIG_DIR_NAME, CONFIG_FILE_NAME);
+    }
+    if (written < 0 || (size_t)written >= size) {
+        log_err("Configuration path exceeds maximum length");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+const char *command_executable_name(const char *command, char *buffer, const size_t size) {
+    while (isspace((unsigned char)*command)) command++;
+    size_t length = strcspn(command, " \t");
+    if (length == 0) return NULL;
+    // Strip the directory part, "/usr/bin/foo --bar" -> "foo"
+    for (size_t i = length; i > 0; i--) {
+        if (command[i - 1] == '/') {
+            command += i;
+            length -= i;
+            break;
+        }
+    }
+    if (length == 0 || length >= size) return NULL;
+    memcpy(buffer, command, length);
+    buffer[length] = '\0';
+    return buffer;
+}
+
+static char *trim(char *str) {
+    while (isspace((unsigned char)*str)) str++;
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return str;
+}
+
+static void free_rule(app_rule_t *rule) {
+    if (!rule) return;
+    free(rule->name);
+    free(rule->exec);
+    free(rule->match);
+    free(rule->profile_name);
+    free(rule);
+}
+
+static void free_profile(profile_t *profile) {
+    if (!profile) return;
+    free(profile->name);
+    free(profile->compression);
+    free(profile->video);
+    free(profile);
+}
+
+static int replace_string(char **target, const char *value) {
+    char *copy = strdup(value);
+    if (!copy) {
+        perror("strdup");
+        return EXIT_FAILURE;
+    }
+    free(*target);
+    *target = copy;
+    return EXIT_SUCCESS;
+}
+
+static int parse_launch_policy(const char *value, launch_policy_t *policy) {
+    if (strcmp(value, "allow-duplicates") == 0) *policy = LAUNCH_ALLOW_DUPLICATES;
+    else if (strcmp(value, "single-instance") == 0) *policy = LAUNCH_SINGLE_INSTANCE;
+    else if (strcmp(value, "reuse-recent") == 0) *policy = LAUNCH_REUSE_RECENT;
+    else return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+static int parse_uint(const char *value, unsigned int *out) {
+    char *end = NULL;
+    errno = 0;
+    const unsigned long parsed = strtoul(value, &end, 10);
+    if (errno || end == value || *end != '\0' || parsed > 0xFFFFFFFFul || value[0] == '-')
+        return EXIT_FAILURE;
+    *out = (unsigned int)parsed;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Accept the compression methods waypipe knows: none, lz4[=level], zstd[=level].
+ */
+static bool is_valid_compression(const char *value) {
+    const char *level = NULL;
+    if (strcmp(value, "none") == 0) return true;
+    if (strncmp(value, "lz4", 3) == 0) level = value + 3;
+    else if (strncmp(value, "zstd", 4) == 0) level = value + 4;
+    else return false;
+    if (*level == '\0') return true;
+    unsigned int ignored;
+    // lz4 takes negative acceleration levels
+    if (level[0] == '=' && level[1] == '-') return parse_uint(level + 2, &ignored) == EXIT_SUCCESS;
+    return level[0] == '=' && parse_uint(level + 1, &ignored) == EXIT_SUCCESS;
+}
+
+/**
+ * Apply one key = value pair to the rule being parsed.
+ */
+static int apply_rule_key(app_rule_t *rule, const char *key, const char *value) {
+    if (strcmp(key, "exec") == 0) return replace_string(&rule->exec, value);
+    if (strcmp(key, "match") == 0) return replace_string(&rule->match, value);
+    if (strcmp(key, "launch") == 0) return parse_launch_policy(value, &rule->launch);
+    if (strcmp(key, "reuse_window") == 0) return parse_uint(value, &rule->reuse_window_s);
+    if (strcmp(key, "profile") == 0) return replace_string(&rule->profile_name, value);
+    return priority_parse(&rule->priority, key, value);
+}
+
+static int apply_profile_key(profile_t *profile, const char *key, const char *value) {
+    if (strcmp(key, "compression") == 0) {
+        if (!is_valid_compression(value)) return EXIT_FAILURE;
+        return replace_string(&profile->compression, value);
+    }
+    if (strcmp(key, "video") == 0) {
+        if (strcmp(value, "none") == 0) {
+            free(profile->video);
+            profile->video = NULL;
+            return EXIT_SUCCESS;
+        }
+        return replace_string(&profile->video, value);
+    }
+    if (strcmp(key, "threads") == 0) return parse_uint(value, &profile->threads);
+    return EXIT_FAILURE;
+}
+
+static int apply_daemon_key(config_t *config, const char *key, const char *value) {
+    if (strcmp(key, "waypipe") == 0) return replace_string(&config->waypipe_path, value);
+    if (strcmp(key, "waypipe_socket") == 0) return replace_string(&config->waypipe_socket, value);
+    if (strcmp(key, "peer_launch_rate") == 0) return parse_uint(value, &config->peer_limits.rate);
+    if (strcmp(key, "peer_launch_burst") == 0) return parse_uint(value, &config->peer_limits.burst);
+    if (strcmp(key, "peer_max_inflight") == 0) return parse_uint(value, &config->peer_limits.max_inflight);
+    if (strcmp(key, "global_launch_rate") == 0) return parse_uint(value, &config->global_limits.rate);
+    if (strcmp(key, "global_launch_burst") == 0) return parse_uint(value, &config->global_limits.burst);
+    if (strcmp(key, "global_max_inflight") == 0) return parse_uint(value, &config->global_limits.max_inflight);
+    if (strcmp(key, "prefetch") == 0) return parse_uint(value, &config->prefetch_apps);
+    if (strcmp(key, "idle_session_timeout") == 0) return parse_uint(value, &config->idle_session_s);
+    if (strcmp(key, "idle_exit_timeout") == 0) return parse_uint(value, &config->idle_exit_s);
+    // daemon_nice, waypipe_cpus, ...
+    if (strncmp(key, "daemon_", 7) == 0) return priority_parse(&config->daemon_priority, key + 7, value);
+    if (strncmp(key, "waypipe_", 8) == 0) return priority_parse(&config->waypipe_priority, key + 8, value);
+    return EXIT_FAILURE;
+}
+
+static profile_t *find_profile(const config_t *config, const char *name) {
+    for (profile_t *profile = config->profiles; profile; profile = profile->next) {
+        if (strcmp(profile->name, name) == 0) return profile;
+    }
+    return NULL;
+}
+
+/**
+ * Get the profile named by a section, creating it if needed.
+ * Repeating a [profile] section extends the first one.
+ */
+static profile_t *get_profile(config_t *config, const char *name) {
+    profile_t *profile = find_profile(config, name);
+    if (profile) return profile;
+    profile = calloc(1, sizeof(profile_t));
+    if (!profile || !(profile->name = strdup(name))) {
+        perror("calloc");
+        free(profile);
+        return NULL;
+    }
+    profile_t **tail = &config->profiles;
+    while (*tail) tail = &(*tail)->next;
+    *tail = profile;
+    return profile;
+}
+
+static void append_rule(config_t *config, app_rule_t ***tail, app_rule_t *rule) {
+    if (!rule->exec && !rule->match) {
+        log_warning("Rule '%s' has neither 'exec' nor 'match', ignoring it", rule->name);
+        free_rule(rule);
+        return;
+    }
+    **tail = rule;
+    *tail = &rule->next;
+    config->rule_count++;
+}
+
+/**
+ * Point every rule at its profile once all profiles are known.
+ */
+static void resolve_profiles(config_t *config) {
+    config->default_profile = find_profile(config, DEFAULT_PROFILE_NAME);
+    for (app_rule_t *rule = config->rules; rule; rule = rule->next) {
+        rule->profile = config->default_profile;
+        if (!rule->profile_name) continue;
+        const profile_t *profile = find_profile(config, rule->profile_name);
+        if (profile) rule->profile = profile;
+        else log_warning("Rule '%s' uses unknown profile '%s'", rule->name, rule->profile_name);
+    }
+}
+
+static void config_free(config_t *config) {
+    if (!config) return;
+    matcher_free(config->matcher);
+    app_rule_t *rule = config->rules;
+    while (rule) {
+        app_rule_t *next = rule->next;
+        free_rule(rule);
+        rule = next;
+    }
+    profile_t *profile = config->profiles;
+    while (profile) {
+        profile_t *next = profile->next;
+        free_profile(profile);
+        profile = next;
+    }
+    free(config->waypipe_path);
+    free(config->waypipe_socket);
+    free(config);
+}
+
+config_t *config_default(void) {
+    config_t *config = calloc(1, sizeof(config_t));
+    if (!config) {
+        perror("calloc");
+        return NULL;
+    }
+    config->refs = 1;
+    config->waypipe_path = strdup(DEFAULT_WAYPIPE_PATH);
+    if (!config->waypipe_path || !get_profile(config, DEFAULT_PROFILE_NAME)) {
+        config_free(config);
+        return NULL;
+    }
+    config->default_profile = config->profiles;
+    config->peer_limits = (launch_limits_t){
+        .rate = DEFAULT_PEER_LAUNCH_RATE,
+        .burst = DEFAULT_PEER_LAUNCH_BURST,
+        .max_inflight = DEFAULT_PEER_MAX_INFLIGHT
+    };
+    config->global_limits = (launch_limits_t){
+        .rate = DEFAULT_GLOBAL_LAUNCH_RATE,
+        .burst = DEFAULT_GLOBAL_LAUNCH_BURST,
+        .max_inflight = DEFAULT_GLOBAL_MAX_INFLIGHT
+    };
+    config->prefetch_apps = DEFAULT_PREFETCH_APPS;
+    config->idle_session_s = DEFAULT_IDLE_SESSION_TIMEOUT_S;
+    config->idle_exit_s = DEFAULT_IDLE_EXIT_TIMEOUT_S;
+    return config;
+}
+
+typedef enum {
+    SECTION_NONE,
+    SECTION_UNKNOWN,
+    SECTION_DAEMON,
+    SECTION_APP,
+    SECTION_PROFILE
+} section_t;
+
+config_t *config_load(const char *path) {
+    config_t *config = config_default();
+    if (!config) return NULL;
+    FILE *file = fopen(path, "re");
+    if (!file) {
+        if (errno != ENOENT) log_warning("Failed to open configuration %s: %s", path, strerror(errno));
+        else log_debug("No configuration at %s, using defaults", path);
+        return config;
+    }
+
+    app_rule_t **tail = &config->rules;
+    app_rule_t *current_rule = NULL;
+    profile_t *current_profile = NULL;
+    section_t section = SECTION_NONE;
+    char line_buf[STANDARD_BUFFER_SIZE];
+    unsigned int line_number = 0;
+    while (fgets(line_buf, sizeof(line_buf), file)) {
+        line_number++;
+        char *line = trim(line_buf);
+        if (line[0] == '\0' || line[0] == '#' || line[0] == ';') continue;
+
+        if (line[0] == '[') {
+            if (current_rule) append_rule(config, &tail, current_rule);
+            current_rule = NULL;
+            current_profile = NULL;
+            section = SECTION_UNKNOWN;
+            char *end = strchr(line, ']');
+            if (!end) {
+                log_warning("%s:%u: unterminated section header", path, line_number);
+                continue;
+            }
+            *end = '\0';
+            char *header = trim(line + 1);
+            if (strcmp(header, "daemon") == 0) {
+                section = SECTION_DAEMON;
+            } else if (strncmp(header, "app", 3) == 0 && isspace((unsigned char)header[3])) {
+                current_rule = calloc(1, sizeof(app_rule_t));
+                if (current_rule) current_rule->name = strdup(trim(header + 3));
+                if (!current_rule || !current_rule->name) {
+                    perror("calloc");
+                    free_rule(current_rule);
+                    current_rule = NULL;
+                } else {
+                    section = SECTION_APP;
+                }
+            } else if (strncmp(header, "profile", 7) == 0 && isspace((unsigned char)header[7])) {
+                current_profile = get_profile(config, trim(header + 7));
+                if (current_profile) section = SECTION_PROFILE;
+            } else {
+                log_warning("%s:%u: unknown section [%s]", path, line_number, header);
+            }
+            continue;
+        }
+
+        if (section == SECTION_UNKNOWN) continue;
+        char *equal = strchr(line, '=');
+        if (!equal) {
+            log_warning("%s:%u: expected key = value", path, line_number);
+            continue;
+        }
+        *equal = '\0';
+        const char *key = trim(line);
+        const char *value = trim(equal + 1);
+        int status = EXIT_FAILURE;
+        switch (section) {
+        case SECTION_DAEMON: status = apply_daemon_key(config, key, value);
+            break;
+        case SECTION_APP: status = apply_rule_key(current_rule, key, value);
+            break;
+        case SECTION_PROFILE: status = apply_profile_key(current_profile, key, value);
+            break;
+        case SECTION_NONE:
+        case SECTION_UNKNOWN:
+            break;
+        }
+        if (status != EXIT_SUCCESS)
+            log_warning("%s:%u: invalid setting '%s = %s'", path, line_number, key, value);
+    }
+    if (current_rule) append_rule(config, &tail, current_rule);
+    fclose(file);
+    resolve_profiles(config);
+    if (config->rules && !(config->matcher = matcher_build(config->rules))) {
+        config_free(config);
+        return NULL;
+    }
+    log_info("Loaded %zu application rule(s) from %s", config->rule_count, path);
+    return config;
+}
+
+config_t *config_ref(config_t *config) {
+    config->refs++;
+    return config;
+}
+
+void config_unref(config_t *config) {
+    if (config && --config->refs == 0) config_free(config);
+}
+
+const profile_t *config_profile(const config_t *config, const app_rule_t *rule) {
+    return rule && rule->profile ? rule->profile : config->default_profile;
+}
+
+const app_rule_t *config_match(const config_t *config, const char *command) {
+    if (!config->matcher) return NULL;
+    char exec_name[STANDARD_BUFFER_SIZE];
+    const char *name = command_executable_name(command, exec_name, sizeof(exec_name));
+    return matcher_find(config->matcher, name, command);
+}
@@ -0,0 +1,186 @@
+/**
+ * @file config.h
+ * @brief Per-application launch configuration of the daemon
+ *
+ * The configuration file is read from $XDG_CONFIG_HOME/waypipe-daemon/config
+ * (falling back to ~/.config). It is a list of sections with key = value
+ * pairs, '#' or ';' starting a comment:
+ *
+ *     [app firefox]
+ *     exec = firefox
+ *     launch = single-instance
+ *
+ * The first rule in file order matching a command wins. Rules are compiled
+ * into a matcher when loaded, see matcher.h. Commands matching no rule use
+ * the defaults (duplicates allowed, default profile).
+ *
+ * [profile <name>] sections set the waypipe transport flags of the session
+ * an application runs in, and the [daemon] section holds global settings.
+ *
+ * A loaded configuration is immutable and reference counted: the daemon
+ * swaps in a new one when the file changes, while launches in progress
+ * keep the one they started with.
+ */
+
+#ifndef WAYPIPEDAEMON_CONFIG_H
+#define WAYPIPEDAEMON_CONFIG_H
+#include <stddef.h>
+#include <stdbool.h>
+#include "priority.h"
+
+#define CONFIG_DIR_NAME "waypipe-daemon"
+#define CONFIG_FILE_NAME "config"
+#define DEFAULT_PROFILE_NAME "default"
+#define DEFAULT_WAYPIPE_PATH "waypipe"
+#define DEFAULT_PEER_LAUNCH_RATE 20
+#define DEFAULT_PEER_LAUNCH_BURST 40
+#define DEFAULT_PEER_MAX_INFLIGHT 16
+#define DEFAULT_GLOBAL_LAUNCH_RATE 100
+#define DEFAULT_GLOBAL_LAUNCH_BURST 200
+#define DEFAULT_GLOBAL_MAX_INFLIGHT 64
+#define DEFAULT_PREFETCH_APPS 8
+#define DEFAULT_IDLE_SESSION_TIMEOUT_S 300
+#define DEFAULT_IDLE_EXIT_TIMEOUT_S 900
+
+/**
+ * @brief What to do when an application matching a rule is launched again
+ */
+typedef enum {
+    LAUNCH_ALLOW_DUPLICATES = 0,  /**< Always spawn a new process (default) */
+    LAUNCH_SINGLE_INSTANCE,       /**< Do nothing while an instance is running */
+    LAUNCH_REUSE_RECENT           /**< Do nothing if an instance started less than reuse_window_s ago */
+} launch_policy_t;
+
+/**
+ * @brief Launch admission limits, 0 disables a limit
+ */
+typedef struct {
+    unsigned int rate;          /**< Sustained launches per second */
+    unsigned int burst;         /**< Launches allowed at once after being idle */
+    unsigned int max_inflight;  /**< Launches being processed at the same time */
+} launch_limits_t;
+
+/**
+ * @brief waypipe transport settings shared by a group of applications
+ *
+ * Applications whose profiles produce the same waypipe flags share a session.
+ */
+typedef struct profile {
+    char *name;                   /**< Section name */
+    char *compression;            /**< --compress value, or NULL for waypipe's default */
+    char *video;                  /**< --video value, or NULL to leave video encoding off */
+    unsigned int threads;         /**< --threads value, 0 for waypipe's default */
+    struct profile *next;         /**< Next profile in file order */
+} profile_t;
+
+/**
+ * @brief A configured application rule
+ */
+typedef struct app_rule {
+    char *name;                   /**< Section name, identifies the application in the registry */
+    char *exec;                   /**< Executable name the command must start with, or NULL */
+    char *match;                  /**< fnmatch() pattern the whole command must match, or NULL */
+    launch_policy_t launch;       /**< Launch policy */
+    unsigned int reuse_window_s;  /**< Window for LAUNCH_REUSE_RECENT, in seconds */
+    char *profile_name;           /**< Name of the profile to use, or NULL for the default one */
+    priority_t priority;          /**< Scheduling settings applied before exec */
+    const profile_t *profile;     /**< Resolved profile, never NULL once loaded */
+    struct app_rule *next;        /**< Next rule in file order */
+} app_rule_t;
+
+struct rule_matcher;
+
+/**
+ * @brief A loaded configuration
+ */
+typedef struct {
+    unsigned int refs;                /**< References held, see config_ref() */
+    app_rule_t *rules;                /**< Rules in file order */
+    size_t rule_count;                /**< Number of rules */
+    struct rule_matcher *matcher;     /**< Compiled rules, NULL when there are none */
+    profile_t *profiles;              /**< Profiles in file order, always contains the default one */
+    const profile_t *default_profile; /**< Profile of commands without one */
+    char *waypipe_path;               /**< waypipe executable, empty to launch without waypipe */
+    char *waypipe_socket;             /**< waypipe --socket path, or NULL for waypipe's default */
+    launch_limits_t peer_limits;      /**< Admission limits of each peer UID */
+    launch_limits_t global_limits;    /**< Admission limits of all peers together */
+    priority_t daemon_priority;       /**< Scheduling settings of the daemon itself */
+    priority_t waypipe_priority;      /**< Scheduling settings of the waypipe sessions */
+    unsigned int prefetch_apps;       /**< Number of predicted applications to prefetch, 0 disables it */
+    unsigned int idle_session_s;      /**< Seconds before an unused session is stopped and caches released, 0 never */
+    unsigned int idle_exit_s;         /**< Seconds with nothing running before the daemon exits, 0 never */
+} config_t;
+
+/**
+ * @brief Get the path of the configuration file for the current user.
+ *
+ * @param buffer Buffer to store the path
+ * @param size Size of the buffer
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+int get_config_path(char *buffer, size_t size);
+
+/**
+ * @brief Create a configuration with only the defaults
+ *
+ * @return The configuration (release with config_unref()), or NULL on allocation failure
+ */
+config_t *config_default(void);
+
+/**
+ * @brief Load the configuration file
+ *
+ * A missing file yields the default configuration. Invalid lines are logged
+ * and skipped so that one typo doesn't disable every other rule.
+ *
+ * @param path Path of the configuration file
+ * @return The configuration (release with config_unref()), or NULL on allocation failure
+ */
+config_t *config_load(const char *path);
+
+/**
+ * @brief Take a reference to a configuration
+ *
+ * @param config The configuration
+ * @return config
+ */
+config_t *config_ref(config_t *config);
+
+/**
+ * @brief Drop a reference, freeing the configuration and its rules with the last one
+ *
+ * @param config The configuration (can be NULL)
+ */
+void config_unref(config_t *config);
+
+/**
+ * @brief Find the rule applying to a command
+ *
+ * @param config The configuration
+ * @param command The command line sent by the client
+ * @return The first matching rule in file order, or NULL if none matches
+ */
+const app_rule_t *config_match(const config_t *config, const char *command);
+
+/**
+ * @brief Get the profile applying to a command
+ *
+ * @param config The configuration
+ * @param rule The rule matching the command, or NULL
+ * @return The profile to use
+ */
+const profile_t *config_profile(const config_t *config, const app_rule_t *rule);
+
+/**
+ * @brief Get the name of the executable of a command
+ *
+ * Extracts the first word of the command and strips its directory.
+ *
+ * @param command The command line
+ * @param buffer Buffer to store the name
+ * @param size Size of the buffer
+ * @return buffer, or NULL if the command has no executable
+ */
+const char *command_executable_name(const char *command, char *buffer, size_t size);
+
+#endif //WAYPIPEDAEMON_CONFIG_H
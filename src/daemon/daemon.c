@@ -1,8 +1,28 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <malloc.h>
+#include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/syslog.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
+#include "daemon.h"
+#include "prefetch.h"
+#include "spawn.h"
+#include "upgrade.h"
 #include "common/logging.h"
+#include "common/trace.h"
 
 // Logging configuration (overrides weak symbols from logging.c)
 const char *get_log_name(void) {
@@ -14,12 +34,1187 @@ int get_log_facility(void) {
 }
 
 
-int main(void) {
-    log_debug("Starting Python daemon");
+/**
+ * Parse a file descriptor passed on the command line. Returns -1 if invalid.
+ */
+static int parse_fd_argument(const char *arg) {
+    char *end = NULL;
+    const long fd = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || fd < 0 || fd > INT_MAX) {
+        log_err("Invalid file descriptor: %s", arg);
+        return -1;
+    }
+    return (int)fd;
+}
+
+int main(const int argc, char *argv[]) {
+    daemon_options_t options = {.detach = true, .state_fd = -1, .listen_fd = -1};
+    bool check_upgrade = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--foreground") == 0) {
+            options.detach = false;
+        } else if (strcmp(argv[i], UPGRADE_CHECK_ARG) == 0) {
+            // Run by upgrade_exec() of the previous executable
+            check_upgrade = true;
+        } else if (strcmp(argv[i], UPGRADE_STATE_ARG) == 0 && i + 1 < argc) {
+            // Passed by upgrade_exec(), we are already detached
+            options.state_fd = parse_fd_argument(argv[++i]);
+            if (options.state_fd < 0) return EXIT_FAILURE;
+            options.detach = false;
+        } else if (strcmp(argv[i], DAEMON_LISTEN_FD_ARG) == 0 && i + 1 < argc) {
+            // Passed by the client that started us, see start_daemon()
+            options.listen_fd = parse_fd_argument(argv[++i]);
+            if (options.listen_fd < 0) return EXIT_FAILURE;
+        } else {
+            log_err("Unknown argument: %s\nUsage: %s [--foreground]", argv[i], argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
 
-    char *pwd = getcwd(NULL, 0);
-    log_debug("Current working directory: %s", pwd);
+    char socket_directory[SOCKET_PATH_MAX];
+    char socket_path[SOCKET_PATH_MAX];
+    if (get_socket_directory(socket_directory, sizeof(socket_directory)) != EXIT_SUCCESS ||
+        get_socket_path(socket_path, sizeof(socket_path), socket_directory) != EXIT_SUCCESS) {
+        log_err("Failed to get socket path");
+        return EXIT_FAILURE;
+    }
+
+    char config_path[STANDARD_BUFFER_SIZE];
+    config_t *config = get_config_path(config_path, sizeof(config_path)) == EXIT_SUCCESS
+                           ? config_load(config_path)
+                           : config_default();
+    if (!config) {
+        log_err("Failed to load configuration");
+        return EXIT_FAILURE;
+    }
+    if (check_upgrade) {
+        config_unref(config);
+        return upgrade_check();
+    }
+    daemon_t daemon;
+    if (daemon_init(&daemon, socket_directory, socket_path, config, &options) != EXIT_SUCCESS) {
+        daemon_cleanup(&daemon);
+        closelog();
+        return EXIT_FAILURE;
+    }
+    const int status = daemon_run(&daemon);
+    daemon_cleanup(&daemon);
+    log_info("Daemon stopped");
     closelog();
+    return status;
+}
+
+int daemonize(void) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    // The socket belongs to the child now, the parent must not clean it up
+    if (pid > 0) _exit(EXIT_SUCCESS);
+    if (chdir("/") < 0) log_warning("Failed to change directory to /");
+    return EXIT_SUCCESS;
+}
+
+static int create_signal_fd(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+        perror("sigprocmask");
+        return -1;
+    }
+    // Responses are sent with MSG_NOSIGNAL, this only covers anything else
+    signal(SIGPIPE, SIG_IGN);
+    const int fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (fd < 0) perror("signalfd");
+    return fd;
+}
+
+/**
+ * Watch the runtime directory for the display sockets created by waypipe.
+ */
+static int create_display_watch(const char *runtime_dir) {
+    const int fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (fd < 0) {
+        perror("inotify_init1");
+        return -1;
+    }
+    if (inotify_add_watch(fd, runtime_dir, IN_CREATE) < 0) {
+        perror("inotify_add_watch");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Watch the directory of the configuration file: editors replace the file rather than writing to it.
+ */
+static int create_config_watch(const char *config_path) {
+    char directory[PATH_MAX];
+    snprintf(directory, sizeof(directory), "%s", config_path);
+    const int fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (fd < 0) {
+        perror("inotify_init1");
+        return -1;
+    }
+    if (inotify_add_watch(fd, dirname(directory), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE) < 0) {
+        // Typically no configuration directory: nothing to reload until the daemon restarts
+        log_info("Not watching %s for changes: %s", directory, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Open the launch history, it's closed while idle.
+ */
+static void open_history(daemon_t *daemon) {
+    if (daemon->history.file) return;
+    char history_path[STANDARD_BUFFER_SIZE];
+    if (get_history_path(history_path, sizeof(history_path)) == EXIT_SUCCESS)
+        history_open(&daemon->history, history_path);  // Optional, launches work without it
+}
+
+/**
+ * Take over the listening socket created by the client that started us.
+ */
+static int adopt_listen_socket(const int fd) {
+    int listening = 0;
+    socklen_t length = sizeof(listening);
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &length) < 0 || !listening) {
+        log_err("File descriptor %d is not a listening socket", fd);
+        return -1;
+    }
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+        perror("fcntl");
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Whether a daemon answers on a socket path, when started by hand next to a running one.
+ * The probe is a regular handshake followed by an orderly close, which the other daemon
+ * drops right away instead of waiting for it like a stalled client.
+ */
+static bool is_daemon_listening(const char *path) {
+    const int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) return false;
+    const auto_close int fd = sockfd;
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0) return false;
+    auto_free_message message_t *hello = create_message(MSG_HELLO, NULL, 0);
+    // Wait for READY so that the close comes after the whole handshake
+    if (hello && send_message(fd, hello) == EXIT_SUCCESS) free_message(read_message(fd));
+    return true;
+}
+
+/**
+ * Create the daemon socket, holding the daemon lock so that no exiting daemon removes it meanwhile.
+ */
+static int create_daemon_socket(const daemon_t *daemon) {
+    const auto_close int lock_fd = lock_daemon(daemon->runtime_dir);
+    if (lock_fd < 0) log_warning("Creating the daemon socket without the daemon lock");
+    if (is_daemon_listening(daemon->socket_path)) {
+        log_err("Another daemon is already listening on %s", daemon->socket_path);
+        return -1;
+    }
+    return create_listen_socket(daemon->socket_path);
+}
+
+int daemon_init(daemon_t *daemon, const char *runtime_dir, const char *socket_path, config_t *config,
+                const daemon_options_t *options) {
+    memset(daemon, 0, sizeof(*daemon));
+    daemon->epfd = -1;
+    daemon->listen_source = (event_source_t){.kind = SOURCE_LISTEN, .fd = -1};
+    daemon->signal_source = (event_source_t){.kind = SOURCE_SIGNAL, .fd = -1};
+    daemon->display_watch = (event_source_t){.kind = SOURCE_DISPLAY_WATCH, .fd = -1};
+    daemon->config_watch = (event_source_t){.kind = SOURCE_CONFIG_WATCH, .fd = -1};
+    snprintf(daemon->runtime_dir, sizeof(daemon->runtime_dir), "%s", runtime_dir);
+    daemon->config = config;
+    daemon->start_ms = monotonic_ms();
+    registry_init(&daemon->registry);
+    daemon->history.fd = -1;
+    admission_init(&daemon->admission, &config->peer_limits, &config->global_limits);
+    snprintf(daemon->socket_path, sizeof(daemon->socket_path), "%s", socket_path);
+    // Resolved now: after an update the same path holds the new executable
+    const ssize_t exe_length = readlink("/proc/self/exe", daemon->exe_path, sizeof(daemon->exe_path) - 1);
+    if (exe_length < 0) perror("readlink");
+    daemon->exe_path[exe_length < 0 ? 0 : exe_length] = '\0';
+    // Until the upgrade is complete, exiting must not take the socket or the sessions down with us
+    daemon->keep_state = options->state_fd >= 0;
+
+    if (options->state_fd < 0) {
+        // Inherited by waypipe, undone in the applications (see launch_command()); kept across upgrades
+        priority_save(&config->daemon_priority, &daemon->app_priority);
+        if (priority_is_set(&config->daemon_priority)) priority_apply(&config->daemon_priority);
+        daemon->listen_source.fd = options->listen_fd >= 0
+                                       ? adopt_listen_socket(options->listen_fd)
+                                       : create_daemon_socket(daemon);
+        if (daemon->listen_source.fd < 0) {
+            daemon->socket_path[0] = '\0';  // Not ours, don't unlink it on cleanup
+            return EXIT_FAILURE;
+        }
+        // Detach before creating the signalfd: its epoll wake-ups stay tied to the creating process
+        if (options->detach && daemonize() != EXIT_SUCCESS) return EXIT_FAILURE;
+    }
+    // Named after the final PID
+    trace_init("wdaemon", TRACE_DAEMON_CAPACITY);
+
+    daemon->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (daemon->epfd < 0) {
+        perror("epoll_create1");
+        return EXIT_FAILURE;
+    }
+    daemon->signal_source.fd = create_signal_fd();
+    if (daemon->signal_source.fd < 0 || event_add(daemon->epfd, &daemon->signal_source, EPOLLIN) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    daemon->display_watch.fd = create_display_watch(daemon->runtime_dir);
+    if (daemon->display_watch.fd < 0 || event_add(daemon->epfd, &daemon->display_watch, EPOLLIN) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    // Optional, a configuration change then takes a restart
+    if (get_config_path(daemon->config_path, sizeof(daemon->config_path)) != EXIT_SUCCESS)
+        daemon->config_path[0] = '\0';
+    else daemon->config_watch.fd = create_config_watch(daemon->config_path);
+    if (daemon->config_watch.fd >= 0 && event_add(daemon->epfd, &daemon->config_watch, EPOLLIN) != EXIT_SUCCESS)
+        event_close(daemon->epfd, &daemon->config_watch);
+    if (options->state_fd >= 0 && upgrade_restore(daemon, options->state_fd) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    if (event_add(daemon->epfd, &daemon->listen_source, EPOLLIN) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    daemon->keep_state = false;
+    open_history(daemon);
+    // Warm the cache right after start, as soon as the first launches are served
+    daemon->prefetch_due_ms = monotonic_ms() + PREFETCH_IDLE_DELAY_MS;
+    log_info("Daemon listening on %s", daemon->socket_path);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Move a client to the end of the deadline-ordered list with a fresh deadline.
+ * Every step has the same timeout, so appending keeps the list sorted.
+ */
+static void client_touch(daemon_t *daemon, client_t *client) {
+    if (client->prev) client->prev->next = client->next;
+    else if (daemon->clients_head == client) daemon->clients_head = client->next;
+    if (client->next) client->next->prev = client->prev;
+    else if (daemon->clients_tail == client) daemon->clients_tail = client->prev;
+
+    client->deadline_ms = monotonic_ms() + CLIENT_TIMEOUT_MS;
+    client->next = NULL;
+    client->prev = daemon->clients_tail;
+    if (daemon->clients_tail) daemon->clients_tail->next = client;
+    else daemon->clients_head = client;
+    daemon->clients_tail = client;
+}
+
+static void client_close(daemon_t *daemon, client_t *client) {
+    event_close(daemon->epfd, &client->source);
+    message_reader_reset(&client->reader);
+    if (client->process) client->process->waiter = NULL;
+    client->process = NULL;
+    client->session = NULL;
+    config_unref(client->config);
+    client->config = NULL;
+    if (client->admitted) admission_release(&daemon->admission, client->uid);
+    client->admitted = false;
+    if (daemon->upgrade_client == client) daemon->upgrade_client = NULL;
+
+    if (client->prev) client->prev->next = client->next;
+    else daemon->clients_head = client->next;
+    if (client->next) client->next->prev = client->prev;
+    else daemon->clients_tail = client->prev;
+    daemon->client_count--;
+
+    // Later events of this iteration may still point at the client
+    client->next = daemon->dead_clients;
+    daemon->dead_clients = client;
+}
+
+/**
+ * Send a response with an optional text payload and close the client.
+ */
+static void client_finish(daemon_t *daemon, client_t *client, const message_type_t type, const char *text) {
+    auto_free_message message_t *response = text
+                                                ? create_message(type, text, STRLENGTH_WITH_NULL(text))
+                                                : create_message(type, NULL, 0);
+    if (!response || send_message(client->source.fd, response) != EXIT_SUCCESS)
+        log_warning("Failed to send response to client");
+    trace_end("request", client->request_id, client->trace_request_ns);
+    client_close(daemon, client);
+}
+
+static void accept_clients(daemon_t *daemon) {
+    for (;;) {
+        const int fd = accept4(daemon->listen_source.fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("accept4");
+            return;
+        }
+        client_t *client = calloc(1, sizeof(client_t));
+        if (!client) {
+            perror("calloc");
+            close(fd);
+            continue;
+        }
+        client->source = (event_source_t){.kind = SOURCE_CLIENT, .fd = fd};
+        client->state = CLIENT_AWAIT_HELLO;
+        client->trace_accept_ns = trace_begin();
+        struct ucred cred;
+        socklen_t cred_length = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_length) == 0) {
+            client->uid = cred.uid;
+        } else {
+            perror("getsockopt(SO_PEERCRED)");
+            client->uid = (uid_t)-1;  // Unknown peers share one bucket
+        }
+        message_reader_init(&client->reader);
+        if (event_add(daemon->epfd, &client->source, EPOLLIN | EPOLLRDHUP) != EXIT_SUCCESS) {
+            close(fd);
+            free(client);
+            continue;
+        }
+        daemon->client_count++;
+        client_touch(daemon, client);
+
+        log_debug("Client connected (%zu connected)", daemon->client_count);
+    }
+}
+
+/**
+ * Decide whether an application's launch policy turns this launch into a no-op.
+ */
+static const process_t *find_reusable_instance(const daemon_t *daemon, const app_rule_t *rule, const char *key) {
+    if (!rule || rule->launch == LAUNCH_ALLOW_DUPLICATES) return NULL;
+    const process_t *process = registry_find(&daemon->registry, key);
+    if (!process) return NULL;
+    switch (rule->launch) {
+    case LAUNCH_SINGLE_INSTANCE:
+        return process;
+    case LAUNCH_REUSE_RECENT:
+        return monotonic_ms() - process->start_ms < (uint64_t)rule->reuse_window_s * 1000u ? process : NULL;
+    case LAUNCH_ALLOW_DUPLICATES:
+        break;
+    }
+    return NULL;
+}
+
+/**
+ * Whether another launch with the same key is parked on a starting session.
+ * It isn't in the registry until its session is ready and it is spawned.
+ */
+static bool is_launch_pending(const daemon_t *daemon, const client_t *client, const char *key) {
+    for (const client_t *other = daemon->clients_head; other; other = other->next) {
+        if (other == client || other->state != CLIENT_AWAIT_SESSION || !other->session ||
+            other->session->state != SESSION_STARTING)
+            continue;
+        if (strcmp(other->launch_key, key) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * Get the session for a profile, starting its waypipe if it isn't running.
+ */
+static session_t *get_session(daemon_t *daemon, const config_t *config, const profile_t *profile,
+                              const uint64_t request_id) {
+    char flags[SESSION_FLAGS_MAX];
+    if (session_flags(profile, flags, sizeof(flags)) != EXIT_SUCCESS) {
+        log_err("waypipe flags of profile '%s' are too long", profile->name);
+        return NULL;
+    }
+    session_t *session = session_find(daemon->sessions, flags);
+    if (session) return session;
+
+    char display[SESSION_DISPLAY_MAX];
+    snprintf(display, sizeof(display), "%s-%d-%u", SESSION_DISPLAY_PREFIX, (int)getpid(), ++daemon->session_seq);
+    const uint64_t start_ns = trace_begin();
+    session = session_start(config, flags, display);
+    if (!session) return NULL;
+    session->request_id = request_id;
+    session->trace_start_ns = start_ns;
+    if (event_add(daemon->epfd, &session->exit_source, EPOLLIN) != EXIT_SUCCESS) {
+        session_stop(session);
+        waitpid(session->pid, NULL, 0);
+        event_close(daemon->epfd, &session->exit_source);
+        session_free(session);
+        return NULL;
+    }
+    session->next = daemon->sessions;
+    daemon->sessions = session;
+    return session;
+}
+
+/**
+ * Drop an application's reference to its session.
+ */
+static void release_session(session_t *session) {
+    if (!session) return;
+    session->app_count--;
+    if (session->app_count == 0) session->idle_since_ms = monotonic_ms();
+    if (session->state == SESSION_DEAD && session->app_count == 0) session_free(session);
+}
+
+static void launch_command(daemon_t *daemon, client_t *client) {
+    if (daemon->caches_released) {
+        daemon->caches_released = false;
+        open_history(daemon);
+    }
+    // The configuration may be reloaded while the launch waits for its session, stick to one
+    const config_t *config = client->config;
+    const char *command = client->command;
+    const app_rule_t *rule = config_match(config, command);
+    const char *key = rule ? rule->name : command;
+
+    const process_t *running = find_reusable_instance(daemon, rule, key);
+    if (running) {
+        char text[STANDARD_BUFFER_SIZE];
+        snprintf(text, sizeof(text), "Already running (pid %d)", (int)running->pid);
+        log_info("Not launching \"%s\": %s is already running as pid %d", command, key, (int)running->pid);
+        client_finish(daemon, client, MSG_RESPONSE_OK, text);
+        return;
+    }
+    if (rule && rule->launch != LAUNCH_ALLOW_DUPLICATES && is_launch_pending(daemon, client, key)) {
+        log_info("Not launching \"%s\": %s is already starting", command, key);
+        client_finish(daemon, client, MSG_RESPONSE_OK, "Already starting");
+        return;
+    }
+
+    if (!client->admitted) {
+        const uint32_t retry_ms = admission_acquire(&daemon->admission, client->uid, monotonic_ms());
+        if (retry_ms > 0) {
+            char text[STANDARD_BUFFER_SIZE];
+            snprintf(text, sizeof(text), "Too many launches, retry later (retry-after=%ums)", retry_ms);
+            log_warning("Refusing \"%s\" from uid %u: retry after %ums", command, (unsigned)client->uid, retry_ms);
+            client_finish(daemon, client, MSG_RESPONSE_ERROR, text);
+            return;
+        }
+        client->admitted = true;
+    }
+
+    session_t *session = NULL;
+    if (config->waypipe_path[0] != '\0') {
+        session = get_session(daemon, config, config_profile(config, rule), client->request_id);
+        if (!session) {
+            client_finish(daemon, client, MSG_RESPONSE_ERROR, "Failed to start the waypipe session");
+            return;
+        }
+        if (session->state == SESSION_STARTING) {
+            // Launched once the display exists, see session_ready()
+            client->session = session;
+            client->launch_key = key;
+            client->state = CLIENT_AWAIT_SESSION;
+            client->trace_wait_ns = trace_begin();
+            event_modify(daemon->epfd, &client->source, EPOLLRDHUP);
+            client_touch(daemon, client);
+            return;
+        }
+    }
+
+    // The application's own settings, over those the daemon had before applying its own
+    priority_t priority = daemon->app_priority;
+    if (rule) priority_override(&priority, &rule->priority);
+    const spawn_options_t options = {
+        .wayland_display = session ? session->display : NULL,
+        .priority = &priority
+    };
+    int exec_status_fd = -1;
+    const uint64_t spawn_us = monotonic_us();
+    const pid_t pid = spawn_command(command, &options, &exec_status_fd);
+    trace_end("spawn", client->request_id, trace_enabled ? spawn_us * 1000u : 0);
+    if (pid < 0) {
+        client_finish(daemon, client, MSG_RESPONSE_ERROR, "Failed to launch command");
+        return;
+    }
+    process_t *process = registry_add(&daemon->registry, pid, key, command);
+    if (!process) {
+        // Without an entry nobody would reap it
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        close(exec_status_fd);
+        client_finish(daemon, client, MSG_RESPONSE_ERROR, "Failed to register process");
+        return;
+    }
+    process->spawn_us = spawn_us;
+    process->request_id = client->request_id;
+    process->session = session;
+    if (session) session->app_count++;
+    process->exec_source.fd = exec_status_fd;
+    process->exit_source.fd = open_pidfd(pid);
+    if (event_add(daemon->epfd, &process->exec_source, EPOLLIN) != EXIT_SUCCESS)
+        event_close(daemon->epfd, &process->exec_source);
+    if (process->exit_source.fd < 0 || event_add(daemon->epfd, &process->exit_source, EPOLLIN) != EXIT_SUCCESS)
+        log_err("Process %d will not be supervised", (int)pid);
+    log_info("Launched \"%s\" as pid %d%s%s", command, (int)pid, session ? " on " : "",
+             session ? session->display : "");
+
+    if (process->exec_source.fd < 0) {
+        client_finish(daemon, client, MSG_RESPONSE_OK, "Command launched");
+        return;
+    }
+    // Answer once the exec outcome is known; only watch for the client hanging up meanwhile
+    process->waiter = client;
+    client->process = process;
+    client->state = CLIENT_AWAIT_EXEC;
+    event_modify(daemon->epfd, &client->source, EPOLLRDHUP);
+    client_touch(daemon, client);
+}
+
+/**
+ * Stop accepting clients and re-exec once the connected ones are served.
+ * Clients connecting meanwhile wait in the listen backlog for the new executable.
+ */
+static void request_upgrade(daemon_t *daemon, client_t *client) {
+    if (client->uid != getuid()) {
+        log_warning("Refusing upgrade requested by uid %u", (unsigned)client->uid);
+        client_finish(daemon, client, MSG_RESPONSE_ERROR, "Permission denied");
+        return;
+    }
+    if (daemon->upgrade_pending) {
+        client_finish(daemon, client, MSG_RESPONSE_ERROR, "Upgrade already in progress");
+        return;
+    }
+    if (daemon->exe_path[0] == '\0') {
+        client_finish(daemon, client, MSG_RESPONSE_ERROR, "Daemon executable is unknown");
+        return;
+    }
+    log_info("Upgrade requested, waiting for %zu client(s) to be served", daemon->client_count - 1);
+    daemon->upgrade_pending = true;
+    daemon->upgrade_client = client;
+    client->state = CLIENT_AWAIT_UPGRADE;
+    event_modify(daemon->epfd, &client->source, EPOLLRDHUP);
+    event_modify(daemon->epfd, &daemon->listen_source, 0);
+    client_touch(daemon, client);
+}
+
+static void perform_upgrade(daemon_t *daemon) {
+    client_t *client = daemon->upgrade_client;
+    upgrade_exec(daemon, client ? client->source.fd : -1);
+    // Still here: carry on with the current executable
+    daemon->upgrade_pending = false;
+    if (client) client_finish(daemon, client, MSG_RESPONSE_ERROR, "Failed to re-execute the daemon");
+    event_modify(daemon->epfd, &daemon->listen_source, EPOLLIN);
+}
+
+/**
+ * Get the resident set size from /proc/self/statm. Returns 0 if unknown.
+ */
+static unsigned long resident_kib(void) {
+    FILE *statm = fopen("/proc/self/statm", "re");
+    if (!statm) return 0;
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    const int parsed = fscanf(statm, "%lu %lu", &size, &resident);
+    fclose(statm);
+    return parsed == 2 ? resident * (unsigned long)sysconf(_SC_PAGESIZE) / 1024u : 0;
+}
+
+/**
+ * Answer a stats request with one "name value" line per counter.
+ */
+static void send_stats(daemon_t *daemon, client_t *client) {
+    size_t sessions = 0;
+    for (const session_t *session = daemon->sessions; session; session = session->next) sessions++;
+    const struct mallinfo2 heap = mallinfo2();
+    const uint64_t now = monotonic_ms();
+    char text[STANDARD_BUFFER_SIZE];
+    snprintf(text, sizeof(text),
+             "pid %d\n"
+             "uptime_s %" PRIu64 "\n"
+             "clients %zu\n"
+             "processes %zu\n"
+             "sessions %zu\n"
+             "rules %zu\n"
+             "rss_kib %lu\n"
+             "heap_in_use_kib %zu\n"
+             "heap_free_kib %zu\n"
+             "history %s\n"
+             "caches %s\n",
+             (int)getpid(), (now - daemon->start_ms) / 1000u, daemon->client_count, daemon->registry.count,
+             sessions, daemon->config->rule_count, resident_kib(), heap.uordblks / 1024u, heap.fordblks / 1024u,
+             daemon->history.file ? "mapped" : "closed", daemon->caches_released ? "released" : "kept");
+    client_finish(daemon, client, MSG_RESPONSE_OK, text);
+}
+
+/**
+ * Parse the request ID of a TRACE message, hexadecimal digits only. Returns 0 if it is malformed.
+ */
+static uint64_t parse_request_id(const message_t *msg) {
+    const size_t length = msg->header.length;
+    if (length < 2 || msg->data[length - 1] != '\0' || strspn(msg->data, "0123456789abcdefABCDEF") != length - 1)
+        return 0;
+    char *end = NULL;
+    errno = 0;
+    const unsigned long long request_id = strtoull(msg->data, &end, 16);
+    if (errno || end != &msg->data[length - 1]) return 0;
+    return request_id;
+}
+
+/**
+ * Handle a complete message. Returns false if the client was closed.
+ */
+static bool handle_message(daemon_t *daemon, client_t *client, const message_t *msg) {
+    // Tracing clients announce their request ID before HELLO
+    if (msg->header.type == MSG_TRACE &&
+        (client->state == CLIENT_AWAIT_HELLO || client->state == CLIENT_AWAIT_SEND)) {
+        client->request_id = parse_request_id(msg);
+        if (client->request_id != 0) return true;
+        log_warning("Invalid request ID from client");
+        client_finish(daemon, client, MSG_RESPONSE_ERROR, "Invalid request ID");
+        return false;
+    }
+    switch (client->state) {
+    case CLIENT_AWAIT_HELLO: {
+        if (msg->header.type != MSG_HELLO) break;
+        auto_free_message message_t *ready = create_message(MSG_READY, NULL, 0);
+        if (!ready || send_message(client->source.fd, ready) != EXIT_SUCCESS) {
+            client_close(daemon, client);
+            return false;
+        }
+        client->state = CLIENT_AWAIT_SEND;
+        client_touch(daemon, client);
+        trace_end("handshake", client->request_id, client->trace_accept_ns);
+        return true;
+    }
+    case CLIENT_AWAIT_SEND:
+        if (msg->header.type == MSG_UPGRADE) {
+            request_upgrade(daemon, client);
+            return false;
+        }
+        if (msg->header.type == MSG_STATS) {
+            send_stats(daemon, client);
+            return false;
+        }
+        if (msg->header.type != MSG_SEND || msg->header.length == 0) break;
+        client->trace_request_ns = trace_begin();
+        // Launches from clients that don't trace are traced under an ID of our own
+        if (client->request_id == 0) client->request_id = trace_request_id();
+        client->command = strdup(msg->data);
+        client->config = config_ref(daemon->config);
+        if (!client->command) {
+            perror("strdup");
+            client_finish(daemon, client, MSG_RESPONSE_ERROR, "Out of memory");
+            return false;
+        }
+        launch_command(daemon, client);
+        return false;
+    case CLIENT_AWAIT_SESSION:
+    case CLIENT_AWAIT_EXEC:
+    case CLIENT_AWAIT_UPGRADE:
+        return true;
+    }
+    char type_name[32];
+    get_message_type_string(msg->header.type, type_name, sizeof(type_name));
+    log_warning("Unexpected %s from client", type_name);
+    client_finish(daemon, client, MSG_RESPONSE_ERROR, "Unexpected message");
+    return false;
+}
+
+static void handle_client_event(daemon_t *daemon, client_t *client, const uint32_t events) {
+    if (client->state == CLIENT_AWAIT_SESSION || client->state == CLIENT_AWAIT_EXEC ||
+        client->state == CLIENT_AWAIT_UPGRADE) {
+        // Only hang-ups are watched in these states
+        log_debug("Client left before its request completed");
+        client_close(daemon, client);
+        return;
+    }
+    if (events & EPOLLIN) {
+        for (;;) {
+            message_t *msg = NULL;
+            const message_reader_status_t status = message_reader_feed(&client->reader, client->source.fd, &msg);
+            if (status == MESSAGE_READER_AGAIN) break;
+            if (status != MESSAGE_READER_DONE) {
+                client_close(daemon, client);
+                return;
+            }
+            const bool keep = handle_message(daemon, client, msg);
+            free_message(msg);
+            if (!keep || client->state == CLIENT_AWAIT_EXEC) return;
+        }
+    }
+    if (events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) client_close(daemon, client);
+}
+
+static void handle_exec_event(daemon_t *daemon, process_t *process) {
+    const int err = read_exec_status(process->exec_source.fd);
+    event_close(daemon->epfd, &process->exec_source);
+    trace_end(err == 0 ? "exec" : "exec_failed", process->request_id, trace_enabled ? process->spawn_us * 1000u : 0);
+    if (err != 0) {
+        log_err("Failed to execute \"%s\": %s", process->command, err > 0 ? strerror(err) : "unknown error");
+    } else {
+        const uint64_t exec_us = monotonic_us() - process->spawn_us;
+        history_record(&daemon->history, process->command, exec_us > UINT32_MAX ? UINT32_MAX : (uint32_t)exec_us);
+    }
+
+    client_t *client = process->waiter;
+    if (!client) return;
+    process->waiter = NULL;
+    client->process = NULL;
+    if (err == 0) {
+        client_finish(daemon, client, MSG_RESPONSE_OK, "Command launched");
+    } else {
+        char text[STANDARD_BUFFER_SIZE];
+        snprintf(text, sizeof(text), "Failed to execute command: %s", err > 0 ? strerror(err) : "unknown error");
+        client_finish(daemon, client, MSG_RESPONSE_ERROR, text);
+    }
+}
+
+static void handle_exit_event(daemon_t *daemon, process_t *process) {
+    // The exec pipe may still be pending in this same batch, settle it first
+    if (process->exec_source.fd >= 0) handle_exec_event(daemon, process);
+
+    int status = 0;
+    if (waitpid(process->pid, &status, WNOHANG) < 0) perror("waitpid");
+    else if (WIFEXITED(status))
+        log_info("Process %d (%s) exited with status %d", (int)process->pid, process->key, WEXITSTATUS(status));
+    else if (WIFSIGNALED(status))
+        log_info("Process %d (%s) killed by signal %d", (int)process->pid, process->key, WTERMSIG(status));
+
+    event_close(daemon->epfd, &process->exit_source);
+    registry_remove(&daemon->registry, process);
+    release_session(process->session);
+    process->session = NULL;
+    process->next = daemon->dead_processes;
+    daemon->dead_processes = process;
+}
+
+/**
+ * Launch the commands that were waiting for a session's display.
+ */
+static void session_ready(daemon_t *daemon, session_t *session) {
+    session->state = SESSION_READY;
+    if (session->exec_status_fd >= 0) close(session->exec_status_fd);
+    session->exec_status_fd = -1;
+    trace_end("waypipe_start", session->request_id, session->trace_start_ns);
+    log_info("waypipe session %s is ready", session->display);
+    client_t *next = NULL;
+    for (client_t *client = daemon->clients_head; client; client = next) {
+        // launch_command() moves the client to the tail or closes it
+        next = client->next;
+        if (client->state != CLIENT_AWAIT_SESSION || client->session != session) continue;
+        client->session = NULL;
+        trace_end("session_wait", client->request_id, client->trace_wait_ns);
+        launch_command(daemon, client);
+    }
+}
+
+static void handle_display_event(daemon_t *daemon) {
+    char event_buf[(sizeof(struct inotify_event) + NAME_MAX + 1) * 8];
+    ssize_t length;
+    while ((length = read(daemon->display_watch.fd, event_buf, sizeof(event_buf))) > 0) {
+        for (ssize_t i = 0; i < length;) {
+            struct inotify_event event;
+            memcpy(&event, &event_buf[i], sizeof(event));
+            const char *name = &event_buf[i + (ssize_t)sizeof(event)];
+            i += (ssize_t)sizeof(event) + event.len;
+            if (event.len == 0) continue;
+            for (session_t *session = daemon->sessions; session; session = session->next) {
+                if (session->state == SESSION_STARTING && strcmp(session->display, name) == 0) {
+                    session_ready(daemon, session);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Remove a session from a list, returns false if it wasn't there.
+ */
+static bool unlink_session(session_t **list, session_t *session) {
+    for (session_t **link = list; *link; link = &(*link)->next) {
+        if (*link == session) {
+            *link = session->next;
+            session->next = NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Swap in a new configuration. Launches in progress hold a reference to the
+ * previous one, which is freed once the last of them is done.
+ */
+static void reload_config(daemon_t *daemon) {
+    const uint64_t start_us = monotonic_us();
+    config_t *config = config_load(daemon->config_path);
+    if (!config) {
+        log_err("Failed to reload the configuration, keeping the current one");
+        return;
+    }
+    config_unref(daemon->config);
+    daemon->config = config;
+    admission_set_limits(&daemon->admission, &config->peer_limits, &config->global_limits);
+    log_info("Configuration reloaded in %" PRIu64 "us", monotonic_us() - start_us);
+}
+
+static void handle_config_event(daemon_t *daemon) {
+    char event_buf[(sizeof(struct inotify_event) + NAME_MAX + 1) * 8];
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", daemon->config_path);
+    const char *file_name = basename(path);
+    bool changed = false;
+    ssize_t length;
+    while ((length = read(daemon->config_watch.fd, event_buf, sizeof(event_buf))) > 0) {
+        for (ssize_t i = 0; i < length;) {
+            struct inotify_event event;
+            memcpy(&event, &event_buf[i], sizeof(event));
+            const char *name = &event_buf[i + (ssize_t)sizeof(event)];
+            i += (ssize_t)sizeof(event) + event.len;
+            if (event.len > 0 && strcmp(name, file_name) == 0) changed = true;
+        }
+    }
+    // One reload for a whole batch of writes
+    if (changed) reload_config(daemon);
+}
+
+static void handle_session_exit_event(daemon_t *daemon, session_t *session) {
+    int status = 0;
+    if (waitpid(session->pid, &status, WNOHANG) < 0) perror("waitpid");
+    else if (session->state == SESSION_DEAD) log_info("Idle waypipe session %s stopped", session->display);
+    else log_warning("waypipe session %s (pid %d) exited with status %d", session->display, (int)session->pid,
+                     WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+
+    if (session->state == SESSION_STARTING) {
+        char text[STANDARD_BUFFER_SIZE];
+        const int err = session->exec_status_fd >= 0 ? read_exec_status(session->exec_status_fd) : -1;
+        if (err > 0) snprintf(text, sizeof(text), "Failed to execute waypipe: %s", strerror(err));
+        else snprintf(text, sizeof(text), "waypipe exited before its display was ready");
+        log_err("%s", text);
+        client_t *next = NULL;
+        for (client_t *client = daemon->clients_head; client; client = next) {
+            next = client->next;
+            if (client->state == CLIENT_AWAIT_SESSION && client->session == session)
+                client_finish(daemon, client, MSG_RESPONSE_ERROR, text);
+        }
+    }
+
+    // Live, or stopped while idle
+    if (!unlink_session(&daemon->sessions, session)) unlink_session(&daemon->dying_sessions, session);
+    session->state = SESSION_DEAD;
+    event_close(daemon->epfd, &session->exit_source);
+    // Running applications still point at it
+    if (session->app_count == 0) session_free(session);
+}
+
+static void handle_signal_event(daemon_t *daemon) {
+    struct signalfd_siginfo info;
+    while (read(daemon->signal_source.fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+        log_info("Received signal %u, shutting down", info.ssi_signo);
+        daemon->running = false;
+    }
+}
+
+static void expire_clients(daemon_t *daemon, const uint64_t now) {
+    while (daemon->clients_head && daemon->clients_head->deadline_ms <= now) {
+        client_t *client = daemon->clients_head;
+        if (client->state == CLIENT_AWAIT_EXEC) {
+            log_warning("Timed out waiting for \"%s\" to start", client->process->command);
+            client_finish(daemon, client, MSG_RESPONSE_ERROR, "Timed out waiting for the command to start");
+        } else if (client->state == CLIENT_AWAIT_UPGRADE) {
+            // Other clients may take a few more steps, the upgrade still happens once they're done
+            client_touch(daemon, client);
+        } else if (client->state == CLIENT_AWAIT_SESSION) {
+            log_warning("Timed out waiting for waypipe session %s", client->session->display);
+            client_finish(daemon, client, MSG_RESPONSE_ERROR, "Timed out waiting for the waypipe session");
+        } else {
+            log_warning("Client timed out");
+            client_close(daemon, client);
+        }
+    }
+}
+
+static bool is_running_command(const daemon_t *daemon, const char *command) {
+    for (const process_t *process = daemon->registry.head; process; process = process->next) {
+        if (strncmp(process->command, command, HISTORY_COMMAND_MAX - 1) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * Warm the page cache for the applications most likely to be launched next.
+ * Those already running are skipped, their files are cached anyway. The pass
+ * goes on over loop iterations, a few files each: returns true once it is over.
+ */
+static bool prefetch_predicted(daemon_t *daemon) {
+    if (!daemon->prefetch) {
+        const size_t max = daemon->config->prefetch_apps;
+        if (max == 0 || !daemon->history.file) return true;
+        history_prediction_t *predictions = calloc(max, sizeof(history_prediction_t));
+        if (!predictions) {
+            perror("calloc");
+            return true;
+        }
+        daemon->prefetch = prefetch_begin();
+        if (!daemon->prefetch) {
+            free(predictions);
+            return true;
+        }
+        daemon->prefetch_start_us = monotonic_us();
+        const size_t count = history_predict(&daemon->history, predictions, max);
+        for (size_t i = 0; i < count; i++) {
+            if (!is_running_command(daemon, predictions[i].command))
+                prefetch_queue_command(daemon->prefetch, predictions[i].command);
+        }
+        free(predictions);
+    }
+    if (prefetch_step(daemon->prefetch, PREFETCH_STEP_FILES)) return false;
+    trace_end("prefetch", 0, trace_enabled ? daemon->prefetch_start_us * 1000u : 0);
+    log_debug("Prefetched %zu file(s) in %" PRIu64 "us", daemon->prefetch->files,
+              monotonic_us() - daemon->prefetch_start_us);
+    prefetch_end(daemon->prefetch);
+    daemon->prefetch = NULL;
+    return true;
+}
+
+/**
+ * Stop the sessions no application used for a while; the next launch starts them again.
+ */
+static void stop_idle_sessions(daemon_t *daemon, const uint64_t now) {
+    const uint64_t timeout_ms = (uint64_t)daemon->config->idle_session_s * 1000u;
+    for (session_t **link = &daemon->sessions; *link;) {
+        session_t *session = *link;
+        if (session->state != SESSION_READY || session->app_count > 0 || now - session->idle_since_ms < timeout_ms) {
+            link = &session->next;
+            continue;
+        }
+        log_info("Stopping waypipe session %s, unused for %" PRIu64 "s", session->display,
+                 (now - session->idle_since_ms) / 1000u);
+        *link = session->next;
+        session->state = SESSION_DEAD;
+        session_stop(session);
+        if (session->exit_source.fd < 0) {
+            session->next = NULL;
+            session_free(session);
+            continue;
+        }
+        // Freed once its exit is reaped, see handle_session_exit_event()
+        session->next = daemon->dying_sessions;
+        daemon->dying_sessions = session;
+    }
+}
+
+/**
+ * Give memory back while idle: the history mapping, the admission state of
+ * past peers and the free pages of the heap.
+ */
+static void release_caches(daemon_t *daemon, const uint64_t now) {
+    const unsigned long before_kib = resident_kib();
+    history_close(&daemon->history);
+    admission_trim(&daemon->admission, now);
+    malloc_trim(0);
+    daemon->caches_released = true;
+    log_info("Idle, released caches (RSS %lu KiB -> %lu KiB)", before_kib, resident_kib());
+}
+
+/**
+ * Replace the listening socket by a new one bound to the same path.
+ */
+static void replace_listen_socket(daemon_t *daemon) {
+    const int fd = create_listen_socket(daemon->socket_path);
+    if (fd < 0) {
+        // Keep serving the clients already accepted, the next idle check exits
+        log_err("Failed to re-create the daemon socket");
+        daemon->socket_path[0] = '\0';
+        return;
+    }
+    event_close(daemon->epfd, &daemon->listen_source);
+    daemon->listen_source.fd = fd;
+    if (event_add(daemon->epfd, &daemon->listen_source, EPOLLIN) != EXIT_SUCCESS) {
+        event_close(daemon->epfd, &daemon->listen_source);
+        unlink(daemon->socket_path);
+        daemon->socket_path[0] = '\0';
+    }
+}
+
+/**
+ * Exit once nothing ran for a while. The socket is removed while holding the
+ * daemon lock: a client either connected before and is served, or finds no
+ * socket and starts a new daemon once the lock is released.
+ */
+static void exit_when_idle(daemon_t *daemon) {
+    const auto_close int lock_fd = lock_daemon(daemon->runtime_dir);
+    if (lock_fd < 0) {
+        // A starting client could lose its socket, try again after another idle period
+        daemon->idle_since_ms = monotonic_ms();
+        return;
+    }
+    if (daemon->socket_path[0] != '\0' && unlink(daemon->socket_path) < 0) perror("unlink");
+    // Clients that connected before the unlink are still queued
+    if (daemon->listen_source.fd >= 0) accept_clients(daemon);
+    if (daemon->client_count > 0) {
+        log_info("%zu client(s) connected while exiting, staying up", daemon->client_count);
+        if (daemon->socket_path[0] != '\0') replace_listen_socket(daemon);
+        return;
+    }
+    log_info("Idle for %us, exiting", daemon->config->idle_exit_s);
+    event_close(daemon->epfd, &daemon->listen_source);
+    // Gone already, and the path may belong to the next daemon soon
+    daemon->socket_path[0] = '\0';
+    daemon->running = false;
+}
+
+/**
+ * Track how long the daemon has been idle and shed what it holds as time passes.
+ */
+static void check_idle(daemon_t *daemon, const uint64_t now) {
+    const config_t *config = daemon->config;
+    if (config->idle_session_s > 0) stop_idle_sessions(daemon, now);
+    if (daemon->client_count > 0 || daemon->registry.count > 0 || daemon->upgrade_pending) {
+        daemon->idle_since_ms = 0;
+        return;
+    }
+    if (daemon->idle_since_ms == 0) daemon->idle_since_ms = now;
+    const uint64_t idle_ms = now - daemon->idle_since_ms;
+    if (config->idle_session_s > 0 && !daemon->caches_released && idle_ms >= (uint64_t)config->idle_session_s * 1000u)
+        release_caches(daemon, now);
+    if (config->idle_exit_s > 0 && idle_ms >= (uint64_t)config->idle_exit_s * 1000u) exit_when_idle(daemon);
+}
+
+/**
+ * Get the next time check_idle() has something to do, or UINT64_MAX.
+ */
+static uint64_t next_idle_deadline(const daemon_t *daemon) {
+    const uint64_t session_ms = (uint64_t)daemon->config->idle_session_s * 1000u;
+    const uint64_t exit_ms = (uint64_t)daemon->config->idle_exit_s * 1000u;
+    uint64_t deadline = UINT64_MAX;
+    if (session_ms > 0) {
+        for (const session_t *session = daemon->sessions; session; session = session->next) {
+            if (session->state == SESSION_READY && session->app_count == 0 &&
+                session->idle_since_ms + session_ms < deadline)
+                deadline = session->idle_since_ms + session_ms;
+        }
+    }
+    if (daemon->idle_since_ms == 0) return deadline;
+    if (session_ms > 0 && !daemon->caches_released && daemon->idle_since_ms + session_ms < deadline)
+        deadline = daemon->idle_since_ms + session_ms;
+    if (exit_ms > 0 && daemon->idle_since_ms + exit_ms < deadline) deadline = daemon->idle_since_ms + exit_ms;
+    return deadline;
+}
+
+static void free_dead(daemon_t *daemon) {
+    while (daemon->dead_clients) {
+        client_t *next = daemon->dead_clients->next;
+        free(daemon->dead_clients->command);
+        free(daemon->dead_clients);
+        daemon->dead_clients = next;
+    }
+    while (daemon->dead_processes) {
+        process_t *next = daemon->dead_processes->next;
+        process_free(daemon->dead_processes);
+        daemon->dead_processes = next;
+    }
+}
+
+int daemon_run(daemon_t *daemon) {
+    struct epoll_event events[DAEMON_MAX_EVENTS];
+    daemon->running = true;
+    // Start the idle clock, the loop only updates it once woken up
+    check_idle(daemon, monotonic_ms());
+    while (daemon->running) {
+        const uint64_t now = monotonic_ms();
+        uint64_t wake_ms = daemon->prefetch_due_ms;
+        const uint64_t idle_ms = next_idle_deadline(daemon);
+        if (idle_ms < wake_ms) wake_ms = idle_ms;
+        if (daemon->clients_head && daemon->clients_head->deadline_ms < wake_ms)
+            wake_ms = daemon->clients_head->deadline_ms;
+        const int timeout = wake_ms > now ? (int)(wake_ms - now) : 0;
+        const int count = epoll_wait(daemon->epfd, events, DAEMON_MAX_EVENTS, timeout);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < count; i++) {
+            event_source_t *source = events[i].data.ptr;
+            if (source->fd < 0) continue;  // Closed earlier in this iteration
+            switch (source->kind) {
+            case SOURCE_LISTEN:
+                if (!daemon->upgrade_pending) accept_clients(daemon);
+                break;
+            case SOURCE_SIGNAL:
+                handle_signal_event(daemon);
+                break;
+            case SOURCE_CLIENT:
+                handle_client_event(daemon, container_of(source, client_t, source), events[i].events);
+                break;
+            case SOURCE_PROCESS_EXEC:
+                handle_exec_event(daemon, container_of(source, process_t, exec_source));
+                break;
+            case SOURCE_PROCESS_EXIT:
+                handle_exit_event(daemon, container_of(source, process_t, exit_source));
+                break;
+            case SOURCE_SESSION_EXIT:
+                handle_session_exit_event(daemon, container_of(source, session_t, exit_source));
+                break;
+            case SOURCE_DISPLAY_WATCH:
+                handle_display_event(daemon);
+                break;
+            case SOURCE_CONFIG_WATCH:
+                handle_config_event(daemon);
+                break;
+            }
+        }
+        const uint64_t after = monotonic_ms();
+        expire_clients(daemon, after);
+        free_dead(daemon);
+        if (daemon->upgrade_pending && daemon->client_count == (daemon->upgrade_client ? 1u : 0u))
+            perform_upgrade(daemon);
+        // Prefetching competes with launches for I/O: only do it once idle, a pass in progress waits too
+        if (daemon->client_count > 0) {
+            if (daemon->prefetch_due_ms < after + PREFETCH_IDLE_DELAY_MS)
+                daemon->prefetch_due_ms = after + PREFETCH_IDLE_DELAY_MS;
+        } else if (after >= daemon->prefetch_due_ms && prefetch_predicted(daemon)) {
+            daemon->prefetch_due_ms = monotonic_ms() + PREFETCH_INTERVAL_MS;
+        }
+        check_idle(daemon, monotonic_ms());
+    }
+    return EXIT_SUCCESS;
+}
 
-    return system("python3 ../daemon.py --send-ready");
+void daemon_cleanup(daemon_t *daemon) {
+    while (daemon->clients_head) client_close(daemon, daemon->clients_head);
+    while (daemon->registry.head) {
+        process_t *process = daemon->registry.head;
+        event_close(daemon->epfd, &process->exec_source);
+        event_close(daemon->epfd, &process->exit_source);
+        registry_remove(&daemon->registry, process);
+        release_session(process->session);
+        process_free(process);
+    }
+    while (daemon->sessions) {
+        session_t *session = daemon->sessions;
+        daemon->sessions = session->next;
+        if (!daemon->keep_state) session_stop(session);
+        event_close(daemon->epfd, &session->exit_source);
+        session_free(session);
+    }
+    while (daemon->dying_sessions) {
+        session_t *session = daemon->dying_sessions;
+        daemon->dying_sessions = session->next;
+        event_close(daemon->epfd, &session->exit_source);
+        session_free(session);
+    }
+    free_dead(daemon);
+    prefetch_end(daemon->prefetch);
+    daemon->prefetch = NULL;
+    admission_free(&daemon->admission);
+    history_close(&daemon->history);
+    event_close(daemon->epfd, &daemon->listen_source);
+    event_close(daemon->epfd, &daemon->signal_source);
+    event_close(daemon->epfd, &daemon->display_watch);
+    event_close(daemon->epfd, &daemon->config_watch);
+    if (daemon->socket_path[0] != '\0' && !daemon->keep_state) unlink(daemon->socket_path);
+    if (daemon->epfd >= 0) close(daemon->epfd);
+    daemon->epfd = -1;
+    config_unref(daemon->config);
+    daemon->config = NULL;
+    trace_close();
 }
@@ -1,6 +1,166 @@
+/**
+ * @file daemon.h
+ * @brief Definitions of the daemon's state and main loop
+ *
+ * The daemon is a single-threaded epoll loop. It accepts clients on the
+ * daemon socket, speaks the HELLO/READY/SEND protocol with them, launches
+ * the requested applications in their waypipe session and supervises both
+ * through pidfds. It can replace its own executable without dropping the
+ * socket or its children, see upgrade.h, and reloads its configuration
+ * when the file changes.
+ */
+
 #ifndef WAYPIPEDAEMON_DAEMON_H
 #define WAYPIPEDAEMON_DAEMON_H
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "common/common.h"
+#include "common/protocol.h"
+#include "admission.h"
+#include "config.h"
+#include "event.h"
+#include "history.h"
+#include "prefetch.h"
+#include "registry.h"
+#include "session.h"
 
 #define RUNNING_PROC_SOCK "waypipe-running-processes.sock"
+#define DAEMON_MAX_EVENTS 64
+/**
+ * @brief How long the daemon must be idle before prefetching
+ */
+#define PREFETCH_IDLE_DELAY_MS 2000
+/**
+ * @brief Interval between prefetch passes, the page cache forgets over time
+ */
+#define PREFETCH_INTERVAL_MS (10 * 60 * 1000)
+
+/**
+ * @brief Protocol state of a connected client
+ */
+typedef enum {
+    CLIENT_AWAIT_HELLO,    /**< Waiting for MSG_HELLO */
+    CLIENT_AWAIT_SEND,     /**< READY sent, waiting for the command */
+    CLIENT_AWAIT_SESSION,  /**< Command received, waiting for its waypipe session to be ready */
+    CLIENT_AWAIT_EXEC,     /**< Command spawned, waiting for the exec outcome */
+    CLIENT_AWAIT_UPGRADE   /**< Upgrade requested, answered by the new executable */
+} client_state_t;
+
+/**
+ * @brief A connected client
+ */
+typedef struct client {
+    event_source_t source;        /**< Client socket */
+    client_state_t state;         /**< Protocol state */
+    message_reader_t reader;      /**< Partially received message */
+    uid_t uid;                    /**< Peer UID from SO_PEERCRED */
+    uint64_t request_id;          /**< Trace ID of the launch, see trace.h */
+    uint64_t trace_accept_ns;     /**< Start of the handshake span */
+    uint64_t trace_request_ns;    /**< Start of the request span */
+    uint64_t trace_wait_ns;       /**< Start of the session wait span */
+    bool admitted;                /**< The launch holds an in-flight admission slot */
+    uint64_t deadline_ms;         /**< CLOCK_MONOTONIC deadline of the current step */
+    char *command;                /**< Command to launch, once received */
+    config_t *config;             /**< Configuration the launch uses, held from the command on */
+    session_t *session;           /**< Session the client is waiting for */
+    const char *launch_key;       /**< Registry key of the launch waiting for its session */
+    process_t *process;           /**< Process whose exec outcome the client is waiting for */
+    struct client *prev;          /**< Previous client, by deadline */
+    struct client *next;          /**< Next client, by deadline */
+} client_t;
+
+/**
+ * @brief The daemon's state
+ */
+typedef struct {
+    int epfd;                              /**< epoll instance */
+    event_source_t listen_source;          /**< Listening daemon socket */
+    event_source_t signal_source;          /**< signalfd for SIGTERM/SIGINT */
+    event_source_t display_watch;          /**< inotify on the runtime directory for session displays */
+    event_source_t config_watch;           /**< inotify on the configuration directory, -1 if not watched */
+    char runtime_dir[SOCKET_PATH_MAX];     /**< Directory of the daemon socket and Wayland displays */
+    char socket_path[SOCKET_PATH_MAX];     /**< Path of the daemon socket */
+    char exe_path[PATH_MAX];               /**< Executable re-executed on upgrade, empty if unknown */
+    char config_path[PATH_MAX];            /**< Configuration file, empty if unknown */
+    config_t *config;                      /**< Current configuration, replaced when the file changes */
+    priority_t app_priority;               /**< Scheduling settings the daemon had before its own, restored in applications */
+    registry_t registry;                   /**< Running processes */
+    admission_t admission;                 /**< Launch rate and concurrency limits */
+    session_t *sessions;                   /**< Live waypipe sessions */
+    session_t *dying_sessions;             /**< Sessions stopped while idle, until their exit is reaped */
+    unsigned int session_seq;              /**< Counter making display names unique */
+    history_t history;                     /**< Launch history, closed while idle */
+    uint64_t prefetch_due_ms;              /**< CLOCK_MONOTONIC time of the next prefetch pass or step */
+    prefetch_pass_t *prefetch;             /**< Prefetch pass in progress, NULL between passes */
+    uint64_t prefetch_start_us;            /**< CLOCK_MONOTONIC start of the pass in progress */
+    client_t *clients_head;                /**< Connected clients, earliest deadline first */
+    client_t *clients_tail;                /**< Connected client with the latest deadline */
+    size_t client_count;                   /**< Number of connected clients */
+    client_t *dead_clients;                /**< Clients closed during the current loop iteration */
+    process_t *dead_processes;             /**< Processes reaped during the current loop iteration */
+    bool upgrade_pending;                  /**< Not accepting clients, re-exec once the connected ones are served */
+    client_t *upgrade_client;              /**< Client that requested the upgrade, if still connected */
+    uint64_t start_ms;                     /**< CLOCK_MONOTONIC start time, for the stats */
+    uint64_t idle_since_ms;                /**< Since when no client is connected and nothing runs, 0 if busy */
+    bool caches_released;                  /**< Memory was released for this idle period */
+    bool running;                          /**< Cleared to leave the main loop */
+    bool keep_state;                       /**< Upgrade state not restored: leave the socket path and sessions on exit */
+} daemon_t;
+
+/**
+ * @brief How the daemon was started
+ */
+typedef struct {
+    bool detach;    /**< Whether to daemonize() once the socket is listening */
+    int state_fd;   /**< State passed by upgrade_exec(), or -1 for a fresh start */
+    int listen_fd;  /**< Listening socket created by the client that started us, or -1 to create it */
+} daemon_options_t;
+
+/**
+ * @brief Create the daemon socket, signalfd and epoll instance
+ *
+ * After an upgrade the socket, sessions and processes are restored from
+ * the state left by the previous executable instead. When a client started
+ * the daemon, it hands over the socket it already bound.
+ *
+ * @param daemon The daemon state to initialize
+ * @param runtime_dir Directory holding the daemon socket
+ * @param socket_path Path of the daemon socket
+ * @param config The configuration, owned by the daemon from now on
+ * @param options How the daemon was started
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+int daemon_init(daemon_t *daemon, const char *runtime_dir, const char *socket_path, config_t *config,
+                const daemon_options_t *options);
+
+/**
+ * @brief Run the event loop until a termination signal is received or the daemon exits while idle
+ *
+ * @param daemon The initialized daemon
+ * @return EXIT_SUCCESS on a clean shutdown, EXIT_FAILURE on failure
+ */
+int daemon_run(daemon_t *daemon);
+
+/**
+ * @brief Close every client, remove the socket and free the daemon's state
+ *
+ * Launched applications are left running, waypipe sessions are stopped.
+ * If daemon_init() failed to take over from a previous executable, the
+ * socket path and the sessions are left as they were.
+ *
+ * @param daemon The daemon to clean up
+ */
+void daemon_cleanup(daemon_t *daemon);
+
+/**
+ * @brief Detach from the launching process
+ *
+ * The client starting the daemon waits for wdaemon to exit, so the parent
+ * exits once the socket is listening and the child carries on.
+ *
+ * @return EXIT_SUCCESS in the child, EXIT_FAILURE on failure (the parent never returns)
+ */
+int daemonize(void);
 
-#endif //WAYPIPEDAEMON_DAEMON_H
\ No newline at end of file
+#endif //WAYPIPEDAEMON_DAEMON_H
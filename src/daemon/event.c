@@ -0,0 +1,38 @@
+#include "event.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+int event_add(const int epfd, event_source_t *source, const uint32_t events) {
+    struct epoll_event ev = {
+        .events = events,
+        .data.ptr = source
+    };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, source->fd, &ev) < 0) {
+        perror("epoll_ctl(ADD)");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int event_modify(const int epfd, event_source_t *source, const uint32_t events) {
+    struct epoll_event ev = {
+        .events = events,
+        .data.ptr = source
+    };
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, source->fd, &ev) < 0) {
+        perror("epoll_ctl(MOD)");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+void event_close(const int epfd, event_source_t *source) {
+    if (!source || source->fd < 0) return;
+    // Closing the fd removes it from the epoll set too, but only if no other
+    // descriptor refers to the same file (e.g. after fork), so be explicit.
+    epoll_ctl(epfd, EPOLL_CTL_DEL, source->fd, NULL);
+    close(source->fd);
+    source->fd = -1;
+}
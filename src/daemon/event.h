@@ -0,0 +1,72 @@
+/**
+ * @file event.h
+ * @brief epoll registration helpers for the daemon's event loop
+ *
+ * Every file descriptor watched by the daemon is registered with a pointer
+ * to an event_source_t embedded in the object that owns it. The loop uses
+ * the kind to dispatch and container_of() to get back to the owner.
+ */
+
+#ifndef WAYPIPEDAEMON_EVENT_H
+#define WAYPIPEDAEMON_EVENT_H
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Get a pointer to the structure containing a member
+ */
+#define container_of(ptr, type, member) ((type *)(void *)((char *)(ptr) - offsetof(type, member)))
+
+/**
+ * @brief Kind of object behind a watched file descriptor
+ */
+typedef enum {
+    SOURCE_LISTEN,        /**< Listening daemon socket */
+    SOURCE_SIGNAL,        /**< signalfd for termination signals */
+    SOURCE_CLIENT,        /**< Connected wdclient */
+    SOURCE_PROCESS_EXEC,  /**< Exec status pipe of a freshly forked process */
+    SOURCE_PROCESS_EXIT,  /**< pidfd of a running process */
+    SOURCE_SESSION_EXIT,  /**< pidfd of a waypipe session */
+    SOURCE_DISPLAY_WATCH, /**< inotify watch for Wayland display sockets */
+    SOURCE_CONFIG_WATCH   /**< inotify watch for changes to the configuration file */
+} source_kind_t;
+
+/**
+ * @brief A file descriptor registered with the event loop
+ */
+typedef struct {
+    source_kind_t kind;  /**< What owns this source */
+    int fd;              /**< Watched file descriptor, -1 when not registered */
+} event_source_t;
+
+/**
+ * @brief Register a source with an epoll instance
+ *
+ * @param epfd The epoll file descriptor
+ * @param source The source to watch, must outlive its registration
+ * @param events epoll events to watch for
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+int event_add(int epfd, event_source_t *source, uint32_t events);
+
+/**
+ * @brief Change the events watched for a registered source
+ *
+ * @param epfd The epoll file descriptor
+ * @param source The registered source
+ * @param events New epoll events to watch for
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+int event_modify(int epfd, event_source_t *source, uint32_t events);
+
+/**
+ * @brief Unregister a source and close its file descriptor
+ *
+ * Null-safe and idempotent: sources with fd < 0 are ignored.
+ *
+ * @param epfd The epoll file descriptor
+ * @param source The source to remove
+ */
+void event_close(int epfd, event_source_t *source);
+
+#endif //WAYPIPEDAEMON_EVENT_H
@@ -0,0 +1,168 @@
+#include "history.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "common/common.h"
+#include "common/logging.h"
+
+_Static_assert(sizeof(history_record_t) == 128, "history records must stay compact");
+
+/**
+ * Create a directory and its missing parents, like mkdir -p.
+ */
+static int make_directories(char *path) {
+    for (char *slash = strchr(path + 1, '/');; slash = strchr(slash + 1, '/')) {
+        if (slash) *slash = '\0';
+        const int status = mkdir(path, 0700);
+        const int err = errno;
+        if (slash) *slash = '/';
+        if (status < 0 && err != EEXIST) {
+            log_warning("Failed to create %s: %s", path, strerror(err));
+            return EXIT_FAILURE;
+        }
+        if (!slash) return EXIT_SUCCESS;
+    }
+}
+
+int get_history_path(char *buffer, const size_t size) {
+    const char *state_home = getenv("XDG_STATE_HOME");
+    const char *home = getenv("HOME");
+    char directory[STANDARD_BUFFER_SIZE];
+    int written;
+    if (state_home && state_home[0] != '\0')
+        written = snprintf(directory, sizeof(directory), "%s/%s", state_home, CONFIG_DIR_NAME);
+    else if (home && home[0] != '\0')
+        written = snprintf(directory, sizeof(directory), "%s/.local/state/%s", home, CONFIG_DIR_NAME);
+    else return EXIT_FAILURE;
+    if (written < 0 || (size_t)written >= sizeof(directory) || make_directories(directory) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    written = snprintf(buffer, size, "%s/%s", directory, HISTORY_FILE_NAME);
+    if (written < 0 || (size_t)written >= size) return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+int history_open(history_t *history, const char *path) {
+    history->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    history->file = NULL;
+    if (history->fd < 0) {
+        log_warning("Failed to open launch history %s: %s", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (ftruncate(history->fd, (off_t)sizeof(history_file_t)) < 0) {
+        perror("ftruncate");
+        history_close(history);
+        return EXIT_FAILURE;
+    }
+    void *map = mmap(NULL, sizeof(history_file_t), PROT_READ | PROT_WRITE, MAP_SHARED, history->fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        history_close(history);
+        return EXIT_FAILURE;
+    }
+    history->file = map;
+    if (history->file->magic != HISTORY_MAGIC || history->file->version != HISTORY_VERSION ||
+        history->file->capacity != HISTORY_CAPACITY || history->file->next >= HISTORY_CAPACITY) {
+        log_info("Initializing launch history %s", path);
+        memset(history->file, 0, sizeof(history_file_t));
+        history->file->magic = HISTORY_MAGIC;
+        history->file->version = HISTORY_VERSION;
+        history->file->capacity = HISTORY_CAPACITY;
+    }
+    return EXIT_SUCCESS;
+}
+
+void history_record(history_t *history, const char *command, const uint32_t exec_us) {
+    if (!history->file) return;
+    history_record_t *record = &history->file->records[history->file->next];
+    record->hash = hash_string(command);
+    record->timestamp = (int64_t)time(NULL);
+    record->exec_us = exec_us;
+    record->reserved = 0;
+    snprintf(record->command, sizeof(record->command), "%s", command);
+    history->file->next = (history->file->next + 1) % HISTORY_CAPACITY;
+    history->file->count++;
+}
+
+/**
+ * Whether a record holds a terminated, non-empty command.
+ */
+static bool is_valid_record(const history_record_t *record) {
+    const size_t length = strnlen(record->command, HISTORY_COMMAND_MAX);
+    return length > 0 && length < HISTORY_COMMAND_MAX;
+}
+
+typedef struct {
+    uint64_t hash;
+    double score;
+    uint32_t latest;  // Index of the newest record of the command
+} command_score_t;
+
+static int compare_hash(const void *a, const void *b) {
+    const command_score_t *left = a, *right = b;
+    return (left->hash > right->hash) - (left->hash < right->hash);
+}
+
+static int compare_score(const void *a, const void *b) {
+    const command_score_t *left = a, *right = b;
+    return (left->score < right->score) - (left->score > right->score);
+}
+
+size_t history_predict(const history_t *history, history_prediction_t *predictions, const size_t max) {
+    if (!history->file || history->file->count == 0 || max == 0) return 0;
+    const size_t used = history->file->count < HISTORY_CAPACITY ? (size_t)history->file->count : HISTORY_CAPACITY;
+    command_score_t *scores = malloc(used * sizeof(command_score_t));
+    if (!scores) {
+        perror("malloc");
+        return 0;
+    }
+    const int64_t now = (int64_t)time(NULL);
+    size_t valid = 0;
+    for (size_t i = 0; i < used; i++) {
+        const history_record_t *record = &history->file->records[i];
+        // The file isn't trusted: skip the records of a truncated or corrupted file
+        if (!is_valid_record(record)) continue;
+        const double age_days = record->timestamp < now ? (double)(now - record->timestamp) / 86400.0 : 0.0;
+        scores[valid++] = (command_score_t){.hash = record->hash, .score = 1.0 / (1.0 + age_days),
+                                            .latest = (uint32_t)i};
+    }
+
+    // Merge the records of each command
+    qsort(scores, valid, sizeof(command_score_t), compare_hash);
+    size_t distinct = 0;
+    for (size_t i = 0; i < valid; i++) {
+        if (distinct > 0 && scores[distinct - 1].hash == scores[i].hash) {
+            command_score_t *merged = &scores[distinct - 1];
+            merged->score += scores[i].score;
+            if (history->file->records[scores[i].latest].timestamp > history->file->records[merged->latest].timestamp)
+                merged->latest = scores[i].latest;
+        } else {
+            scores[distinct++] = scores[i];
+        }
+    }
+    qsort(scores, distinct, sizeof(command_score_t), compare_score);
+
+    const size_t count = distinct < max ? distinct : max;
+    for (size_t i = 0; i < count; i++) {
+        const char *command = history->file->records[scores[i].latest].command;
+        snprintf(predictions[i].command, sizeof(predictions[i].command), "%.*s",
+                 (int)strnlen(command, HISTORY_COMMAND_MAX), command);
+        predictions[i].score = scores[i].score;
+    }
+    free(scores);
+    return count;
+}
+
+void history_close(history_t *history) {
+    if (history->file) munmap(history->file, sizeof(history_file_t));
+    history->file = NULL;
+    if (history->fd >= 0) close(history->fd);
+    history->fd = -1;
+}
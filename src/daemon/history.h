@@ -0,0 +1,115 @@
+/**
+ * @file history.h
+ * @brief Persistent launch history used to predict the next launches
+ *
+ * The history is a fixed-size ring of records in a memory-mapped file under
+ * $XDG_STATE_HOME/waypipe-daemon (~/.local/state by default). Recording a
+ * launch is a memcpy into the mapping; the kernel writes it back.
+ */
+
+#ifndef WAYPIPEDAEMON_HISTORY_H
+#define WAYPIPEDAEMON_HISTORY_H
+#include <stddef.h>
+#include <stdint.h>
+
+#define HISTORY_FILE_NAME "history"
+#define HISTORY_MAGIC 0x31485744u  /* "WDH1" */
+#define HISTORY_VERSION 1u
+#define HISTORY_CAPACITY 1024u
+/**
+ * @brief Bytes of the command kept per record, including the terminator
+ *
+ * Sized so that a record is 128 bytes; longer commands are truncated,
+ * which still leaves the executable for prefetching.
+ */
+#define HISTORY_COMMAND_MAX 104
+
+/**
+ * @brief One recorded launch
+ */
+typedef struct {
+    uint64_t hash;                      /**< Hash of the full command */
+    int64_t timestamp;                  /**< CLOCK_REALTIME seconds of the launch */
+    uint32_t exec_us;                   /**< Time from spawn to successful exec, in microseconds */
+    uint32_t reserved;                  /**< Zero */
+    char command[HISTORY_COMMAND_MAX];  /**< Command, possibly truncated */
+} history_record_t;
+
+/**
+ * @brief Layout of the history file
+ */
+typedef struct {
+    uint32_t magic;                               /**< HISTORY_MAGIC */
+    uint32_t version;                             /**< HISTORY_VERSION */
+    uint32_t capacity;                            /**< HISTORY_CAPACITY */
+    uint32_t next;                                /**< Ring index of the next record to write */
+    uint64_t count;                               /**< Launches recorded since the file was created */
+    history_record_t records[HISTORY_CAPACITY];   /**< Ring of records */
+} history_file_t;
+
+/**
+ * @brief An open history
+ */
+typedef struct {
+    int fd;                /**< History file, -1 when closed */
+    history_file_t *file;  /**< Shared mapping of the file, NULL when closed */
+} history_t;
+
+/**
+ * @brief A command predicted to be launched soon
+ */
+typedef struct {
+    char command[HISTORY_COMMAND_MAX];  /**< The command */
+    double score;                       /**< Launch frequency weighted by recency */
+} history_prediction_t;
+
+/**
+ * @brief Get the path of the history file, creating its directory
+ *
+ * @param buffer Buffer to store the path
+ * @param size Size of the buffer
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+int get_history_path(char *buffer, size_t size);
+
+/**
+ * @brief Open and map the history file, resetting it if it isn't valid
+ *
+ * @param history The history to open
+ * @param path Path of the history file
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure (history stays closed)
+ */
+int history_open(history_t *history, const char *path);
+
+/**
+ * @brief Record a successful launch
+ *
+ * No-op on a closed history.
+ *
+ * @param history The history
+ * @param command The launched command
+ * @param exec_us Time from spawn to exec in microseconds
+ */
+void history_record(history_t *history, const char *command, uint32_t exec_us);
+
+/**
+ * @brief Predict the commands most likely to be launched next
+ *
+ * Each distinct command scores the sum of 1 / (1 + age in days) over its
+ * launches, so frequently and recently launched commands come first.
+ *
+ * @param history The history
+ * @param predictions Array receiving the predictions, best first
+ * @param max Size of the array
+ * @return Number of predictions written
+ */
+size_t history_predict(const history_t *history, history_prediction_t *predictions, size_t max);
+
+/**
+ * @brief Unmap and close the history file
+ *
+ * @param history The history (can be closed already)
+ */
+void history_close(history_t *history);
+
+#endif //WAYPIPEDAEMON_HISTORY_H
@@ -0,0 +1,168 @@
+#include "matcher.h"
+#include <fnmatch.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GLOB_SPECIAL "*?[\\"
+
+/**
+ * Classify a glob. Only a literal between an optional leading and trailing
+ * star avoids fnmatch(), which is what most `match` settings look like.
+ */
+static int compile_pattern(pattern_t *pattern, const char *glob) {
+    *pattern = (pattern_t){.kind = PATTERN_NONE, .glob = glob};
+    if (!glob) return EXIT_SUCCESS;
+    const size_t length = strlen(glob);
+    const size_t start = glob[0] == '*' ? 1 : 0;
+    const size_t end = length > start && glob[length - 1] == '*' ? length - 1 : length;
+    const size_t literal = strcspn(glob + start, GLOB_SPECIAL);
+    if (start + literal >= end) {
+        if (start == 0) pattern->kind = end == length ? PATTERN_LITERAL : PATTERN_PREFIX;
+        else pattern->kind = end == length ? PATTERN_SUFFIX : PATTERN_CONTAINS;
+        pattern->length = end - start;
+        pattern->text = strndup(glob + start, pattern->length);
+    } else {
+        pattern->kind = PATTERN_GLOB;
+        pattern->length = strcspn(glob, GLOB_SPECIAL);
+        pattern->text = strndup(glob, pattern->length);
+    }
+    if (!pattern->text) {
+        perror("strndup");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static bool pattern_matches(const pattern_t *pattern, const char *command, const size_t length) {
+    switch (pattern->kind) {
+    case PATTERN_NONE:
+        return true;
+    case PATTERN_LITERAL:
+        return length == pattern->length && memcmp(command, pattern->text, length) == 0;
+    case PATTERN_PREFIX:
+        return strncmp(command, pattern->text, pattern->length) == 0;
+    case PATTERN_SUFFIX:
+        return length >= pattern->length &&
+               memcmp(command + length - pattern->length, pattern->text, pattern->length) == 0;
+    case PATTERN_CONTAINS:
+        return strstr(command, pattern->text) != NULL;
+    case PATTERN_GLOB:
+        return strncmp(command, pattern->text, pattern->length) == 0 && fnmatch(pattern->glob, command, 0) == 0;
+    }
+    return false;
+}
+
+static const trie_node_t *trie_find(const trie_node_t *node, const char *name) {
+    for (const unsigned char *p = (const unsigned char *)name; *p && node; p++) {
+        const trie_node_t *child = node->child;
+        while (child && child->byte != *p) child = child->sibling;
+        node = child;
+    }
+    return node;
+}
+
+/**
+ * Get the node of a name, creating the missing ones.
+ */
+static trie_node_t *trie_insert(trie_node_t *node, const char *name) {
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        trie_node_t *child = node->child;
+        while (child && child->byte != *p) child = child->sibling;
+        if (!child) {
+            child = calloc(1, sizeof(trie_node_t));
+            if (!child) {
+                perror("calloc");
+                return NULL;
+            }
+            child->byte = *p;
+            child->sibling = node->child;
+            node->child = child;
+        }
+        node = child;
+    }
+    return node;
+}
+
+static void free_entries(matcher_entry_t *entries, const size_t count) {
+    for (size_t i = 0; i < count; i++) free(entries[i].pattern.text);
+    free(entries);
+}
+
+static void trie_free(trie_node_t *node) {
+    trie_node_t *child = node->child;
+    while (child) {
+        trie_node_t *next = child->sibling;
+        trie_free(child);
+        free(child);
+        child = next;
+    }
+    free_entries(node->entries, node->entry_count);
+}
+
+/**
+ * Append a rule to a list of entries. Rules are added in file order, so lists stay sorted.
+ */
+static int append_entry(matcher_entry_t **entries, size_t *count, const app_rule_t *rule, const size_t order) {
+    matcher_entry_t *grown = realloc(*entries, (*count + 1) * sizeof(matcher_entry_t));
+    if (!grown) {
+        perror("realloc");
+        return EXIT_FAILURE;
+    }
+    *entries = grown;
+    matcher_entry_t *entry = &grown[*count];
+    entry->rule = rule;
+    entry->order = order;
+    if (compile_pattern(&entry->pattern, rule->match) != EXIT_SUCCESS) return EXIT_FAILURE;
+    (*count)++;
+    return EXIT_SUCCESS;
+}
+
+rule_matcher_t *matcher_build(const app_rule_t *rules) {
+    rule_matcher_t *matcher = calloc(1, sizeof(rule_matcher_t));
+    if (!matcher) {
+        perror("calloc");
+        return NULL;
+    }
+    size_t order = 0;
+    for (const app_rule_t *rule = rules; rule; rule = rule->next, order++) {
+        int status;
+        if (rule->exec) {
+            trie_node_t *node = trie_insert(&matcher->root, rule->exec);
+            status = node ? append_entry(&node->entries, &node->entry_count, rule, order) : EXIT_FAILURE;
+        } else {
+            status = append_entry(&matcher->generic, &matcher->generic_count, rule, order);
+        }
+        if (status != EXIT_SUCCESS) {
+            matcher_free(matcher);
+            return NULL;
+        }
+    }
+    return matcher;
+}
+
+const app_rule_t *matcher_find(const rule_matcher_t *matcher, const char *name, const char *command) {
+    const trie_node_t *node = name ? trie_find(&matcher->root, name) : NULL;
+    const matcher_entry_t *named = node ? node->entries : NULL;
+    const size_t named_count = node ? node->entry_count : 0;
+    const size_t length = strlen(command);
+    // Merge both lists by file order, the first rule matching wins
+    size_t i = 0;
+    size_t j = 0;
+    while (i < named_count || j < matcher->generic_count) {
+        const matcher_entry_t *entry = j >= matcher->generic_count ||
+                                       (i < named_count && named[i].order < matcher->generic[j].order)
+                                           ? &named[i++]
+                                           : &matcher->generic[j++];
+        if (pattern_matches(&entry->pattern, command, length)) return entry->rule;
+    }
+    return NULL;
+}
+
+void matcher_free(rule_matcher_t *matcher) {
+    if (!matcher) return;
+    trie_free(&matcher->root);
+    free_entries(matcher->generic, matcher->generic_count);
+    free(matcher);
+}
@@ -0,0 +1,94 @@
+/**
+ * @file matcher.h
+ * @brief Compiled form of the application rules
+ *
+ * Rules naming an executable are indexed in a byte trie keyed on that
+ * name, so a launch only looks at the rules for its own executable. The
+ * `match` globs are classified once (literal, prefix, suffix, substring or
+ * full glob) so most of them are checked without fnmatch(). Candidates from
+ * the trie and the rules without an executable are merged in file order:
+ * the first rule matching wins, as if the rules were tried one by one.
+ */
+
+#ifndef WAYPIPEDAEMON_MATCHER_H
+#define WAYPIPEDAEMON_MATCHER_H
+#include <stddef.h>
+#include "config.h"
+
+/**
+ * @brief How a `match` glob is checked
+ */
+typedef enum {
+    PATTERN_NONE,      /**< No pattern, anything matches */
+    PATTERN_LITERAL,   /**< No wildcard: the command must equal the text */
+    PATTERN_PREFIX,    /**< "text*" */
+    PATTERN_SUFFIX,    /**< "*text" */
+    PATTERN_CONTAINS,  /**< "*text*" */
+    PATTERN_GLOB       /**< Anything else, fnmatch() after checking the literal prefix */
+} pattern_kind_t;
+
+/**
+ * @brief A precompiled `match` glob
+ */
+typedef struct {
+    pattern_kind_t kind;  /**< How to check it */
+    const char *glob;     /**< The rule's glob, for PATTERN_GLOB */
+    char *text;           /**< Literal part of the glob (its prefix for PATTERN_GLOB) */
+    size_t length;        /**< Length of text */
+} pattern_t;
+
+/**
+ * @brief A rule with its compiled pattern
+ */
+typedef struct {
+    const app_rule_t *rule;  /**< The rule, owned by the configuration */
+    size_t order;            /**< Position of the rule in the file */
+    pattern_t pattern;       /**< Compiled `match` glob */
+} matcher_entry_t;
+
+/**
+ * @brief Node of the executable name trie
+ */
+typedef struct trie_node {
+    unsigned char byte;          /**< Byte leading to this node */
+    struct trie_node *child;     /**< First child */
+    struct trie_node *sibling;   /**< Next child of the parent */
+    matcher_entry_t *entries;    /**< Rules for the name ending here, in file order */
+    size_t entry_count;          /**< Number of entries */
+} trie_node_t;
+
+/**
+ * @brief Compiled rules of a configuration
+ */
+typedef struct rule_matcher {
+    trie_node_t root;             /**< Rules with an `exec` name */
+    matcher_entry_t *generic;     /**< Rules without one, in file order */
+    size_t generic_count;         /**< Number of generic rules */
+} rule_matcher_t;
+
+/**
+ * @brief Compile a list of rules
+ *
+ * @param rules Rules in file order, must outlive the matcher
+ * @return The matcher (free with matcher_free()), or NULL on allocation failure
+ */
+rule_matcher_t *matcher_build(const app_rule_t *rules);
+
+/**
+ * @brief Find the first rule, in file order, matching a command
+ *
+ * @param matcher The compiled rules
+ * @param name Executable name of the command, see command_executable_name(), or NULL
+ * @param command The command line
+ * @return The rule, or NULL if none matches
+ */
+const app_rule_t *matcher_find(const rule_matcher_t *matcher, const char *name, const char *command);
+
+/**
+ * @brief Free a matcher
+ *
+ * @param matcher The matcher (can be NULL)
+ */
+void matcher_free(rule_matcher_t *matcher);
+
+#endif //WAYPIPEDAEMON_MATCHER_H
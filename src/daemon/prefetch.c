@@ -0,0 +1,259 @@
+#include "prefetch.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include "common/common.h"
+#include "common/logging.h"
+
+#define PREFETCH_MAX_NEEDED 64
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+/**
+ * Queue a file unless it was seen earlier in the pass or the pass is full.
+ */
+static void queue_file(prefetch_pass_t *pass, const char *path, const unsigned int depth) {
+    const uint64_t hash = hash_string(path);
+    for (size_t i = 0; i < pass->seen_count; i++) {
+        if (pass->hashes[i] == hash) return;
+    }
+    if (pass->seen_count >= PREFETCH_MAX_FILES) return;
+    char *copy = strdup(path);
+    if (!copy) {
+        perror("strdup");
+        return;
+    }
+    pass->hashes[pass->seen_count++] = hash;
+    pass->queue[pass->queued++] = (prefetch_item_t){.path = copy, .depth = depth};
+}
+
+/**
+ * Dynamic linking information of a mapped ELF file, pointing into the mapping.
+ */
+typedef struct {
+    const char *interpreter;
+    const char *runpath;
+    const char *needed[PREFETCH_MAX_NEEDED];
+    size_t needed_count;
+} elf_deps_t;
+
+/**
+ * Translate a virtual address to a file offset using the PT_LOAD segments.
+ */
+static bool vaddr_to_offset(const ElfW(Phdr) *phdrs, const size_t count, const ElfW(Addr) vaddr, size_t *offset) {
+    for (size_t i = 0; i < count; i++) {
+        if (phdrs[i].p_type != PT_LOAD) continue;
+        if (vaddr >= phdrs[i].p_vaddr && vaddr < phdrs[i].p_vaddr + phdrs[i].p_filesz) {
+            *offset = (size_t)(phdrs[i].p_offset + (vaddr - phdrs[i].p_vaddr));
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char *string_at(const char *map, const size_t size, const size_t offset) {
+    if (offset >= size || !memchr(map + offset, '\0', size - offset)) return NULL;
+    return map + offset;
+}
+
+/**
+ * Parse the interpreter, DT_NEEDED and DT_RUNPATH of a native ELF file.
+ * Every offset is checked against the mapping: the file isn't trusted.
+ */
+static bool parse_elf(const char *map, const size_t size, elf_deps_t *deps) {
+    memset(deps, 0, sizeof(*deps));
+    if (size < sizeof(ElfW(Ehdr)) || memcmp(map, ELFMAG, SELFMAG) != 0) return false;
+    ElfW(Ehdr) ehdr;
+    memcpy(&ehdr, map, sizeof(ehdr));
+#if __SIZEOF_POINTER__ == 8
+    if (ehdr.e_ident[EI_CLASS] != ELFCLASS64) return false;
+#else
+    if (ehdr.e_ident[EI_CLASS] != ELFCLASS32) return false;
+#endif
+    if (ehdr.e_phentsize != sizeof(ElfW(Phdr)) || ehdr.e_phoff > size ||
+        (size - ehdr.e_phoff) / sizeof(ElfW(Phdr)) < ehdr.e_phnum)
+        return false;
+    ElfW(Phdr) *phdrs = malloc(ehdr.e_phnum * sizeof(ElfW(Phdr)));
+    if (!phdrs) return false;
+    memcpy(phdrs, map + ehdr.e_phoff, ehdr.e_phnum * sizeof(ElfW(Phdr)));
+
+    const ElfW(Phdr) *dynamic = NULL;
+    for (size_t i = 0; i < ehdr.e_phnum; i++) {
+        if (phdrs[i].p_type == PT_INTERP) deps->interpreter = string_at(map, size, phdrs[i].p_offset);
+        else if (phdrs[i].p_type == PT_DYNAMIC) dynamic = &phdrs[i];
+    }
+    if (!dynamic || dynamic->p_offset > size || size - dynamic->p_offset < dynamic->p_filesz) {
+        free(phdrs);
+        return deps->interpreter != NULL;
+    }
+
+    const size_t dyn_count = dynamic->p_filesz / sizeof(ElfW(Dyn));
+    ElfW(Addr) strtab = 0;
+    size_t needed_offsets[PREFETCH_MAX_NEEDED];
+    size_t runpath_offset = SIZE_MAX;
+    for (size_t i = 0; i < dyn_count; i++) {
+        ElfW(Dyn) dyn;
+        memcpy(&dyn, map + dynamic->p_offset + i * sizeof(ElfW(Dyn)), sizeof(dyn));
+        if (dyn.d_tag == DT_NULL) break;
+        if (dyn.d_tag == DT_STRTAB) strtab = dyn.d_un.d_ptr;
+        else if (dyn.d_tag == DT_NEEDED && deps->needed_count < PREFETCH_MAX_NEEDED)
+            needed_offsets[deps->needed_count++] = dyn.d_un.d_val;
+        else if (dyn.d_tag == DT_RUNPATH || (dyn.d_tag == DT_RPATH && runpath_offset == SIZE_MAX))
+            runpath_offset = dyn.d_un.d_val;
+    }
+    size_t strtab_offset = 0;
+    const bool has_strtab = strtab && vaddr_to_offset(phdrs, ehdr.e_phnum, strtab, &strtab_offset);
+    free(phdrs);
+    if (!has_strtab) {
+        deps->needed_count = 0;
+        return deps->interpreter != NULL;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < deps->needed_count; i++) {
+        const char *name = string_at(map, size, strtab_offset + needed_offsets[i]);
+        if (name) deps->needed[kept++] = name;
+    }
+    deps->needed_count = kept;
+    if (runpath_offset != SIZE_MAX) deps->runpath = string_at(map, size, strtab_offset + runpath_offset);
+    return true;
+}
+
+/**
+ * Look for a file in a colon-separated list of directories.
+ * $ORIGIN is replaced by origin, the directory of the object asking for it.
+ */
+static bool search_dirs(const char *dirs, const char *name, const char *origin, char *out, const size_t size) {
+    for (const char *dir = dirs; dir && *dir;) {
+        const char *end = strchr(dir, ':');
+        const size_t length = end ? (size_t)(end - dir) : strlen(dir);
+        if (length > 0) {
+            int written;
+            if (strncmp(dir, "$ORIGIN", 7) == 0)
+                written = snprintf(out, size, "%s%.*s/%s", origin, (int)(length - 7), dir + 7, name);
+            else written = snprintf(out, size, "%.*s/%s", (int)length, dir, name);
+            if (written > 0 && (size_t)written < size && access(out, F_OK) == 0) return true;
+        }
+        dir = end ? end + 1 : NULL;
+    }
+    return false;
+}
+
+/**
+ * The directories the dynamic loader falls back to, multiarch ones included.
+ */
+static const char *default_library_dirs(void) {
+    static char dirs[STANDARD_BUFFER_SIZE];
+    if (dirs[0] != '\0') return dirs;
+    struct utsname name;
+    if (uname(&name) == 0) {
+        snprintf(dirs, sizeof(dirs),
+                 "/lib/%s-linux-gnu:/usr/lib/%s-linux-gnu:/lib64:/usr/lib64:/lib:/usr/lib:/usr/local/lib",
+                 name.machine, name.machine);
+    } else {
+        snprintf(dirs, sizeof(dirs), "/lib64:/usr/lib64:/lib:/usr/lib:/usr/local/lib");
+    }
+    return dirs;
+}
+
+static void queue_dependencies(prefetch_pass_t *pass, const char *path, const elf_deps_t *deps,
+                               const unsigned int depth) {
+    char origin[PATH_MAX];
+    snprintf(origin, sizeof(origin), "%s", path);
+    char *slash = strrchr(origin, '/');
+    if (slash) *slash = '\0';
+
+    if (deps->interpreter) queue_file(pass, deps->interpreter, depth + 1);
+    for (size_t i = 0; i < deps->needed_count; i++) {
+        char library[PATH_MAX];
+        if (strchr(deps->needed[i], '/')) {
+            queue_file(pass, deps->needed[i], depth + 1);
+        } else if (search_dirs(deps->runpath, deps->needed[i], origin, library, sizeof(library)) ||
+                   search_dirs(default_library_dirs(), deps->needed[i], origin, library, sizeof(library))) {
+            queue_file(pass, library, depth + 1);
+        }
+    }
+}
+
+/**
+ * Start the readahead of a file and queue the files it needs. Returns false if it can't be opened.
+ */
+static bool prefetch_file(prefetch_pass_t *pass, const prefetch_item_t *item) {
+    const int fd = open(item->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    // Asynchronous: queues readahead of the whole file and returns
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    if (item->depth < PREFETCH_MAX_DEPTH && st.st_size > 0) {
+        const size_t size = (size_t)st.st_size;
+        const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return true;
+        elf_deps_t deps;
+        if (parse_elf(map, size, &deps)) queue_dependencies(pass, item->path, &deps, item->depth);
+        munmap((void *)map, size);
+        return true;
+    }
+    close(fd);
+    return true;
+}
+
+/**
+ * Resolve the executable of a command the way execvp() does.
+ */
+static bool resolve_executable(const char *command, char *out, const size_t size) {
+    while (*command == ' ' || *command == '\t') command++;
+    const size_t length = strcspn(command, " \t");
+    if (length == 0 || length >= NAME_MAX) return false;
+    char name[NAME_MAX + 1];
+    memcpy(name, command, length);
+    name[length] = '\0';
+    if (strchr(name, '/')) {
+        snprintf(out, size, "%s", name);
+        return true;
+    }
+    const char *path = getenv("PATH");
+    return search_dirs(path && *path ? path : DEFAULT_PATH, name, "", out, size);
+}
+
+prefetch_pass_t *prefetch_begin(void) {
+    prefetch_pass_t *pass = calloc(1, sizeof(prefetch_pass_t));
+    if (!pass) perror("calloc");
+    return pass;
+}
+
+void prefetch_queue_command(prefetch_pass_t *pass, const char *command) {
+    char executable[PATH_MAX];
+    if (!resolve_executable(command, executable, sizeof(executable))) {
+        log_debug("Cannot resolve the executable of \"%s\" for prefetching", command);
+        return;
+    }
+    queue_file(pass, executable, 0);
+}
+
+bool prefetch_step(prefetch_pass_t *pass, const size_t max_files) {
+    for (size_t handled = 0; handled < max_files && pass->next < pass->queued; handled++) {
+        prefetch_item_t *item = &pass->queue[pass->next++];
+        if (prefetch_file(pass, item)) pass->files++;
+        free(item->path);
+        item->path = NULL;
+    }
+    return pass->next < pass->queued;
+}
+
+void prefetch_end(prefetch_pass_t *pass) {
+    if (!pass) return;
+    for (size_t i = pass->next; i < pass->queued; i++) free(pass->queue[i].path);
+    free(pass);
+}
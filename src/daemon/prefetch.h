@@ -0,0 +1,91 @@
+/**
+ * @file prefetch.h
+ * @brief Warming the page cache for applications about to be launched
+ *
+ * The executable of a command, its ELF interpreter and the shared libraries
+ * it needs (recursively) are opened and handed to posix_fadvise(WILLNEED),
+ * which starts asynchronous readahead without blocking the daemon.
+ *
+ * Opening and parsing a file still reads its headers, which blocks on a
+ * cold disk. A pass is therefore a queue of files worked through a few at a
+ * time with prefetch_step(), and the daemon returns to epoll_wait() in
+ * between: a launch arriving mid-pass waits for a handful of files at most.
+ */
+
+#ifndef WAYPIPEDAEMON_PREFETCH_H
+#define WAYPIPEDAEMON_PREFETCH_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Maximum number of files prefetched in one pass
+ */
+#define PREFETCH_MAX_FILES 512
+/**
+ * @brief How deep to follow DT_NEEDED from an executable
+ */
+#define PREFETCH_MAX_DEPTH 4
+/**
+ * @brief Number of files handled per prefetch_step() from the daemon loop
+ */
+#define PREFETCH_STEP_FILES 8
+
+/**
+ * @brief A file waiting to be prefetched
+ */
+typedef struct {
+    char *path;          /**< Path of the file */
+    unsigned int depth;  /**< DT_NEEDED links followed to reach it */
+} prefetch_item_t;
+
+/**
+ * @brief A prefetch pass, possibly spread over several loop iterations
+ *
+ * Libraries are shared between applications, remembering the files seen
+ * avoids parsing libc once per application. Every file is queued once, when
+ * first seen, so the queue never outgrows the set.
+ */
+typedef struct {
+    uint64_t hashes[PREFETCH_MAX_FILES];          /**< Hashes of the paths seen */
+    size_t seen_count;                            /**< Number of paths seen */
+    prefetch_item_t queue[PREFETCH_MAX_FILES];    /**< Files seen, in the order they are handled */
+    size_t queued;                                /**< Number of files queued */
+    size_t next;                                  /**< Next file to handle */
+    size_t files;                                 /**< Files prefetched so far */
+} prefetch_pass_t;
+
+/**
+ * @brief Start a prefetch pass
+ *
+ * @return The pass (free with prefetch_end()), or NULL on allocation failure
+ */
+prefetch_pass_t *prefetch_begin(void);
+
+/**
+ * @brief Queue the executable of a command
+ *
+ * Its interpreter and libraries are queued as it is handled.
+ *
+ * @param pass The pass
+ * @param command The command line, its first word is resolved through PATH
+ */
+void prefetch_queue_command(prefetch_pass_t *pass, const char *command);
+
+/**
+ * @brief Prefetch the next queued files
+ *
+ * @param pass The pass
+ * @param max_files Maximum number of files to handle
+ * @return true if files remain queued
+ */
+bool prefetch_step(prefetch_pass_t *pass, size_t max_files);
+
+/**
+ * @brief Free a pass, finished or not
+ *
+ * @param pass The pass (can be NULL)
+ */
+void prefetch_end(prefetch_pass_t *pass);
+
+#endif //WAYPIPEDAEMON_PREFETCH_H
@@ -0,0 +1,177 @@
+#include "priority.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "common/logging.h"
+
+// From linux/ioprio.h, which older kernel headers don't ship
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+static int parse_int(const char *value, const long min, const long max, int *out) {
+    char *end = NULL;
+    errno = 0;
+    const long parsed = strtol(value, &end, 10);
+    if (errno || end == value || *end != '\0' || parsed < min || parsed > max) return EXIT_FAILURE;
+    *out = (int)parsed;
+    return EXIT_SUCCESS;
+}
+
+static int parse_ioprio(priority_t *priority, const char *value) {
+    const char *level = strchr(value, ':');
+    const size_t name_length = level ? (size_t)(level - value) : strlen(value);
+    ioprio_class_t class;
+    if (strncmp(value, "idle", name_length) == 0 && name_length == 4) class = IOPRIO_IDLE;
+    else if (strncmp(value, "best-effort", name_length) == 0 && name_length == 11) class = IOPRIO_BEST_EFFORT;
+    else if (strncmp(value, "realtime", name_length) == 0 && name_length == 8) class = IOPRIO_REALTIME;
+    else return EXIT_FAILURE;
+    int parsed_level = 4;  // The kernel's default level
+    if (level && (class == IOPRIO_IDLE || parse_int(level + 1, 0, 7, &parsed_level) != EXIT_SUCCESS))
+        return EXIT_FAILURE;
+    priority->ioprio_class = class;
+    priority->ioprio_level = class == IOPRIO_IDLE ? 0 : parsed_level;
+    return EXIT_SUCCESS;
+}
+
+static int parse_policy(priority_t *priority, const char *value) {
+    if (strcmp(value, "other") == 0) priority->policy = SCHED_OTHER;
+    else if (strcmp(value, "batch") == 0) priority->policy = SCHED_BATCH;
+    else if (strcmp(value, "idle") == 0) priority->policy = SCHED_IDLE;
+    else return EXIT_FAILURE;
+    priority->set_policy = true;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Parse a CPU list such as "0-3,6".
+ */
+static int parse_cpus(priority_t *priority, const char *value) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    const char *cursor = value;
+    do {
+        char *end = NULL;
+        errno = 0;
+        const unsigned long first = strtoul(cursor, &end, 10);
+        if (errno || end == cursor) return EXIT_FAILURE;
+        unsigned long last = first;
+        if (*end == '-') {
+            cursor = end + 1;
+            last = strtoul(cursor, &end, 10);
+            if (errno || end == cursor || last < first) return EXIT_FAILURE;
+        }
+        if (last >= CPU_SETSIZE) return EXIT_FAILURE;
+        for (unsigned long cpu = first; cpu <= last; cpu++) CPU_SET(cpu, &cpus);
+        if (*end != ',' && *end != '\0') return EXIT_FAILURE;
+        cursor = *end == ',' ? end + 1 : end;
+    } while (*cursor != '\0');
+    if (CPU_COUNT(&cpus) == 0) return EXIT_FAILURE;
+    priority->cpus = cpus;
+    priority->set_affinity = true;
+    return EXIT_SUCCESS;
+}
+
+int priority_parse(priority_t *priority, const char *key, const char *value) {
+    if (strcmp(key, "nice") == 0) {
+        if (parse_int(value, -20, 19, &priority->nice) != EXIT_SUCCESS) return EXIT_FAILURE;
+        priority->set_nice = true;
+        return EXIT_SUCCESS;
+    }
+    if (strcmp(key, "ioprio") == 0) return parse_ioprio(priority, value);
+    if (strcmp(key, "sched") == 0) return parse_policy(priority, value);
+    if (strcmp(key, "cpus") == 0) return parse_cpus(priority, value);
+    return EXIT_FAILURE;
+}
+
+bool priority_is_set(const priority_t *priority) {
+    return priority->set_nice || priority->ioprio_class != IOPRIO_UNCHANGED || priority->set_policy ||
+           priority->set_affinity;
+}
+
+int priority_apply(const priority_t *priority) {
+    int status = EXIT_SUCCESS;
+    if (priority->set_affinity && sched_setaffinity(0, sizeof(priority->cpus), &priority->cpus) < 0) {
+        log_warning("Failed to set CPU affinity: %s", strerror(errno));
+        status = EXIT_FAILURE;
+    }
+    if (priority->set_policy) {
+        const struct sched_param param = {.sched_priority = 0};
+        if (sched_setscheduler(0, priority->policy, &param) < 0) {
+            log_warning("Failed to set scheduling policy %d: %s", priority->policy, strerror(errno));
+            status = EXIT_FAILURE;
+        }
+    }
+    if (priority->set_nice && setpriority(PRIO_PROCESS, 0, priority->nice) < 0) {
+        log_warning("Failed to set nice level %d: %s", priority->nice, strerror(errno));
+        status = EXIT_FAILURE;
+    }
+    if (priority->ioprio_class != IOPRIO_UNCHANGED) {
+        const int class = priority->ioprio_class == IOPRIO_NONE ? 0 : (int)priority->ioprio_class;
+        const int ioprio = (class << IOPRIO_CLASS_SHIFT) | priority->ioprio_level;
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) < 0) {
+            log_warning("Failed to set I/O priority: %s", strerror(errno));
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
+
+void priority_save(const priority_t *changes, priority_t *saved) {
+    memset(saved, 0, sizeof(*saved));
+    if (changes->set_affinity) {
+        if (sched_getaffinity(0, sizeof(saved->cpus), &saved->cpus) == 0) saved->set_affinity = true;
+        else log_warning("Failed to get CPU affinity: %s", strerror(errno));
+    }
+    if (changes->set_policy) {
+        const int policy = sched_getscheduler(0);
+        if (policy >= 0) {
+            saved->policy = policy & ~SCHED_RESET_ON_FORK;
+            saved->set_policy = true;
+        } else {
+            log_warning("Failed to get scheduling policy: %s", strerror(errno));
+        }
+    }
+    if (changes->set_nice) {
+        errno = 0;
+        const int nice = getpriority(PRIO_PROCESS, 0);
+        if (errno == 0) {
+            saved->nice = nice;
+            saved->set_nice = true;
+        } else {
+            log_warning("Failed to get nice level: %s", strerror(errno));
+        }
+    }
+    if (changes->ioprio_class != IOPRIO_UNCHANGED) {
+        const long ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+        if (ioprio >= 0) {
+            const int class = (int)(ioprio >> IOPRIO_CLASS_SHIFT);
+            saved->ioprio_class = class == 0 ? IOPRIO_NONE : (ioprio_class_t)class;
+            saved->ioprio_level = (int)(ioprio & ((1 << IOPRIO_CLASS_SHIFT) - 1));
+        } else {
+            log_warning("Failed to get I/O priority: %s", strerror(errno));
+        }
+    }
+}
+
+void priority_override(priority_t *priority, const priority_t *overrides) {
+    if (overrides->set_nice) {
+        priority->nice = overrides->nice;
+        priority->set_nice = true;
+    }
+    if (overrides->ioprio_class != IOPRIO_UNCHANGED) {
+        priority->ioprio_class = overrides->ioprio_class;
+        priority->ioprio_level = overrides->ioprio_level;
+    }
+    if (overrides->set_policy) {
+        priority->policy = overrides->policy;
+        priority->set_policy = true;
+    }
+    if (overrides->set_affinity) {
+        priority->cpus = overrides->cpus;
+        priority->set_affinity = true;
+    }
+}
@@ -0,0 +1,91 @@
+/**
+ * @file priority.h
+ * @brief CPU and I/O scheduling settings of launched processes
+ *
+ * Settings are parsed from the configuration and applied in the child
+ * between fork and exec, or to the daemon itself at startup. Applying them
+ * is best effort: a setting the kernel refuses (e.g. a negative nice level
+ * without CAP_SYS_NICE) is logged and the launch goes on.
+ */
+
+#ifndef WAYPIPEDAEMON_PRIORITY_H
+#define WAYPIPEDAEMON_PRIORITY_H
+#include <sched.h>
+#include <stdbool.h>
+
+/**
+ * @brief ioprio classes, see ioprio_set(2)
+ */
+typedef enum {
+    IOPRIO_UNCHANGED = 0,    /**< Keep the inherited I/O priority */
+    IOPRIO_REALTIME = 1,     /**< IOPRIO_CLASS_RT */
+    IOPRIO_BEST_EFFORT = 2,  /**< IOPRIO_CLASS_BE */
+    IOPRIO_IDLE = 3,         /**< IOPRIO_CLASS_IDLE */
+    IOPRIO_NONE = 4          /**< IOPRIO_CLASS_NONE: follow the nice level, the kernel's default */
+} ioprio_class_t;
+
+/**
+ * @brief Scheduling settings, every field can be left unchanged
+ */
+typedef struct {
+    bool set_nice;                /**< Whether nice is set */
+    int nice;                     /**< Nice level, -20 to 19 */
+    ioprio_class_t ioprio_class;  /**< I/O scheduling class */
+    int ioprio_level;             /**< Level within the class, 0 (highest) to 7 */
+    bool set_policy;              /**< Whether policy is set */
+    int policy;                   /**< SCHED_OTHER, SCHED_BATCH or SCHED_IDLE */
+    bool set_affinity;            /**< Whether cpus is set */
+    cpu_set_t cpus;               /**< CPU affinity */
+} priority_t;
+
+/**
+ * @brief Apply one configuration key to scheduling settings
+ *
+ * Known keys: nice (-20..19), ioprio (idle, best-effort[:level],
+ * realtime[:level]), sched (other, batch, idle) and cpus (a list like 0-3,6).
+ *
+ * @param priority The settings to update
+ * @param key The configuration key
+ * @param value The configuration value
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE for an unknown key or invalid value
+ */
+int priority_parse(priority_t *priority, const char *key, const char *value);
+
+/**
+ * @brief Check whether any setting differs from the inherited ones
+ *
+ * @param priority The settings
+ * @return true if priority_apply() would change something
+ */
+bool priority_is_set(const priority_t *priority);
+
+/**
+ * @brief Apply scheduling settings to the calling process
+ *
+ * Safe to call between fork and exec in the single-threaded daemon.
+ *
+ * @param priority The settings
+ * @return EXIT_SUCCESS if everything applied, EXIT_FAILURE if a setting was refused
+ */
+int priority_apply(const priority_t *priority);
+
+/**
+ * @brief Read the current values of the settings another set changes
+ *
+ * Taken before the daemon applies its own settings, so that the
+ * applications it launches don't inherit them.
+ *
+ * @param changes The settings about to be applied
+ * @param saved Set to the current value of each setting changes sets, nothing else is set
+ */
+void priority_save(const priority_t *changes, priority_t *saved);
+
+/**
+ * @brief Override settings with those set in another set
+ *
+ * @param priority The settings to update
+ * @param overrides The settings taking precedence, only those set are copied
+ */
+void priority_override(priority_t *priority, const priority_t *overrides);
+
+#endif //WAYPIPEDAEMON_PRIORITY_H
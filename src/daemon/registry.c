@@ -0,0 +1,72 @@
+#include "registry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common/common.h"
+
+void registry_init(registry_t *registry) {
+    memset(registry, 0, sizeof(*registry));
+}
+
+process_t *registry_add(registry_t *registry, const pid_t pid, const char *key, const char *command) {
+    process_t *process = calloc(1, sizeof(process_t));
+    if (!process) {
+        perror("calloc");
+        return NULL;
+    }
+    process->key = strdup(key);
+    process->command = strdup(command);
+    if (!process->key || !process->command) {
+        perror("strdup");
+        free(process->key);
+        free(process->command);
+        free(process);
+        return NULL;
+    }
+    process->exec_source = (event_source_t){.kind = SOURCE_PROCESS_EXEC, .fd = -1};
+    process->exit_source = (event_source_t){.kind = SOURCE_PROCESS_EXIT, .fd = -1};
+    process->pid = pid;
+    process->spawn_us = monotonic_us();
+    process->start_ms = process->spawn_us / 1000u;
+    process->hash = hash_string(key);
+
+    process_t **bucket = &registry->buckets[process->hash & (REGISTRY_BUCKETS - 1)];
+    process->bucket_next = *bucket;
+    if (*bucket) (*bucket)->bucket_pprev = &process->bucket_next;
+    process->bucket_pprev = bucket;
+    *bucket = process;
+
+    process->prev = registry->tail;
+    if (registry->tail) registry->tail->next = process;
+    else registry->head = process;
+    registry->tail = process;
+    registry->count++;
+    return process;
+}
+
+void registry_remove(registry_t *registry, process_t *process) {
+    *process->bucket_pprev = process->bucket_next;
+    if (process->bucket_next) process->bucket_next->bucket_pprev = process->bucket_pprev;
+
+    if (process->prev) process->prev->next = process->next;
+    else registry->head = process->next;
+    if (process->next) process->next->prev = process->prev;
+    else registry->tail = process->prev;
+    registry->count--;
+}
+
+void process_free(process_t *process) {
+    if (!process) return;
+    free(process->key);
+    free(process->command);
+    free(process);
+}
+
+process_t *registry_find(const registry_t *registry, const char *key) {
+    const uint64_t hash = hash_string(key);
+    for (process_t *process = registry->buckets[hash & (REGISTRY_BUCKETS - 1)]; process;
+         process = process->bucket_next) {
+        if (process->hash == hash && strcmp(process->key, key) == 0) return process;
+    }
+    return NULL;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file registry.h
+ * @brief Registry of the processes launched by the daemon
+ *
+ * Processes are indexed by their application key (the matching rule's name,
+ * or the command itself when no rule applies) so that launch policies can
+ * check for a running instance in constant time.
+ */
+
+#ifndef WAYPIPEDAEMON_REGISTRY_H
+#define WAYPIPEDAEMON_REGISTRY_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "event.h"
+
+/**
+ * @brief Number of hash buckets, must be a power of two
+ */
+#define REGISTRY_BUCKETS 256
+
+struct session;
+
+/**
+ * @brief A process launched by the daemon
+ */
+typedef struct process {
+    event_source_t exec_source;  /**< Exec status pipe, closed once the exec outcome is known */
+    event_source_t exit_source;  /**< pidfd, readable when the process exits */
+    pid_t pid;                   /**< Process ID */
+    char *key;                   /**< Application key used by launch policies */
+    char *command;               /**< Command line as sent by the client */
+    uint64_t start_ms;           /**< CLOCK_MONOTONIC time of the spawn */
+    uint64_t spawn_us;           /**< CLOCK_MONOTONIC time of the spawn, in microseconds */
+    uint64_t hash;               /**< Hash of key */
+    uint64_t request_id;         /**< Trace ID of the launch, see trace.h */
+    void *waiter;                /**< Client waiting for the exec outcome, or NULL */
+    struct session *session;     /**< waypipe session the process runs in, or NULL */
+    struct process *prev;        /**< Previous process in launch order */
+    struct process *next;        /**< Next process in launch order */
+    struct process *bucket_next;   /**< Next process in the same bucket */
+    struct process **bucket_pprev; /**< Link pointing to this process in its bucket */
+} process_t;
+
+/**
+ * @brief The registry itself
+ */
+typedef struct {
+    process_t *buckets[REGISTRY_BUCKETS];  /**< Hash buckets, newest process first */
+    process_t *head;                       /**< All processes, oldest first */
+    process_t *tail;                       /**< Newest process */
+    size_t count;                          /**< Number of registered processes */
+} registry_t;
+
+/**
+ * @brief Initialize an empty registry
+ *
+ * @param registry The registry to initialize
+ */
+void registry_init(registry_t *registry);
+
+/**
+ * @brief Register a newly spawned process
+ *
+ * Both event sources are initialized with fd = -1; the caller fills them in.
+ *
+ * @param registry The registry
+ * @param pid The process ID
+ * @param key The application key
+ * @param command The command line
+ * @return The new entry, or NULL on allocation failure
+ */
+process_t *registry_add(registry_t *registry, pid_t pid, const char *key, const char *command);
+
+/**
+ * @brief Unregister a process entry without freeing it
+ *
+ * The entry's prev/next links are left dangling, the caller may reuse
+ * next to queue the entry for process_free().
+ *
+ * @param registry The registry
+ * @param process The entry to remove
+ */
+void registry_remove(registry_t *registry, process_t *process);
+
+/**
+ * @brief Free a process entry
+ *
+ * The caller is responsible for closing the entry's event sources first.
+ *
+ * @param process The entry to free (can be NULL)
+ */
+void process_free(process_t *process);
+
+/**
+ * @brief Find the most recently launched process with a given key
+ *
+ * @param registry The registry
+ * @param key The application key
+ * @return The newest matching process, or NULL if none is running
+ */
+process_t *registry_find(const registry_t *registry, const char *key);
+
+#endif //WAYPIPEDAEMON_REGISTRY_H
@@ -0,0 +1,112 @@
+#include "session.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "spawn.h"
+#include "common/common.h"
+#include "common/logging.h"
+
+static int append_flag(char *buffer, const size_t size, size_t *used, const char *name, const char *value) {
+    const int written = snprintf(buffer + *used, size - *used, "%s--%s=%s", *used ? " " : "", name, value);
+    if (written < 0 || (size_t)written >= size - *used) return EXIT_FAILURE;
+    *used += (size_t)written;
+    return EXIT_SUCCESS;
+}
+
+int session_flags(const profile_t *profile, char *buffer, const size_t size) {
+    size_t used = 0;
+    buffer[0] = '\0';
+    if (profile->compression &&
+        append_flag(buffer, size, &used, "compress", profile->compression) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    if (profile->video && append_flag(buffer, size, &used, "video", profile->video) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    if (profile->threads > 0) {
+        char threads[16];
+        snprintf(threads, sizeof(threads), "%u", profile->threads);
+        if (append_flag(buffer, size, &used, "threads", threads) != EXIT_SUCCESS) return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+session_t *session_start(const config_t *config, const char *flags, const char *display) {
+    session_t *session = calloc(1, sizeof(session_t));
+    if (!session) {
+        perror("calloc");
+        return NULL;
+    }
+    session->exit_source = (event_source_t){.kind = SOURCE_SESSION_EXIT, .fd = -1};
+    session->exec_status_fd = -1;
+    session->state = SESSION_STARTING;
+    session->idle_since_ms = monotonic_ms();
+    snprintf(session->display, sizeof(session->display), "%s", display);
+    session->flags = strdup(flags);
+    if (!session->flags) {
+        perror("strdup");
+        free(session);
+        return NULL;
+    }
+
+    // waypipe [flags...] [--socket path] --display name server -- sleep infinity
+    // The keep-alive command holds the session open between applications.
+    char flags_buf[SESSION_FLAGS_MAX];
+    snprintf(flags_buf, sizeof(flags_buf), "%s", flags);
+    char *argv[SESSION_MAX_ARGS];
+    size_t argc = 0;
+    argv[argc++] = config->waypipe_path;
+    for (char *save = NULL, *flag = strtok_r(flags_buf, " ", &save); flag && argc < SESSION_MAX_ARGS - 9;
+         flag = strtok_r(NULL, " ", &save)) {
+        argv[argc++] = flag;
+    }
+    if (config->waypipe_socket) {
+        argv[argc++] = "--socket";
+        argv[argc++] = config->waypipe_socket;
+    }
+    argv[argc++] = "--display";
+    argv[argc++] = session->display;
+    argv[argc++] = "server";
+    argv[argc++] = "--";
+    argv[argc++] = "sleep";
+    argv[argc++] = "infinity";
+    argv[argc] = NULL;
+
+    const spawn_options_t options = {
+        .priority = &config->waypipe_priority
+    };
+    session->pid = spawn_argv(argv, &options, &session->exec_status_fd);
+    if (session->pid < 0) {
+        session_free(session);
+        return NULL;
+    }
+    session->exit_source.fd = open_pidfd(session->pid);
+    if (session->exit_source.fd < 0) {
+        session_stop(session);
+        waitpid(session->pid, NULL, 0);
+        session_free(session);
+        return NULL;
+    }
+    log_info("Started waypipe session %s (pid %d) with flags \"%s\"", session->display, (int)session->pid, flags);
+    return session;
+}
+
+session_t *session_find(session_t *sessions, const char *flags) {
+    for (session_t *session = sessions; session; session = session->next) {
+        if (strcmp(session->flags, flags) == 0) return session;
+    }
+    return NULL;
+}
+
+void session_stop(const session_t *session) {
+    // spawn_argv() made waypipe a session leader: signal the keep-alive too
+    if (kill(-session->pid, SIGTERM) < 0) kill(session->pid, SIGTERM);
+}
+
+void session_free(session_t *session) {
+    if (!session) return;
+    if (session->exec_status_fd >= 0) close(session->exec_status_fd);
+    free(session->flags);
+    free(session);
+}
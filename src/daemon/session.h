@@ -0,0 +1,106 @@
+/**
+ * @file session.h
+ * @brief waypipe sessions shared by the launched applications
+ *
+ * A session is one `waypipe server` process exposing a Wayland display.
+ * Applications are launched with WAYLAND_DISPLAY pointing at the session
+ * matching their profile, so apps with the same transport flags share one
+ * waypipe connection.
+ */
+
+#ifndef WAYPIPEDAEMON_SESSION_H
+#define WAYPIPEDAEMON_SESSION_H
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "config.h"
+#include "event.h"
+
+#define SESSION_DISPLAY_MAX 64
+#define SESSION_DISPLAY_PREFIX "wayland-wd"
+/**
+ * @brief Longest waypipe flags string built from a profile
+ */
+#define SESSION_FLAGS_MAX 512
+/**
+ * @brief Maximum number of arguments passed to waypipe
+ */
+#define SESSION_MAX_ARGS 32
+
+/**
+ * @brief Lifecycle of a session
+ */
+typedef enum {
+    SESSION_STARTING,  /**< waypipe spawned, its display doesn't exist yet */
+    SESSION_READY,     /**< Display created, applications can be launched */
+    SESSION_DEAD       /**< waypipe exited or was stopped while idle, kept until its last application exits */
+} session_state_t;
+
+/**
+ * @brief A running waypipe session
+ */
+typedef struct session {
+    event_source_t exit_source;        /**< pidfd of the waypipe process */
+    int exec_status_fd;                /**< Exec status pipe, kept to report why waypipe failed */
+    pid_t pid;                         /**< PID of the waypipe process (and its process group) */
+    session_state_t state;             /**< Lifecycle state */
+    char *flags;                       /**< Transport flags, identifies the session */
+    char display[SESSION_DISPLAY_MAX]; /**< Wayland display name created by waypipe */
+    size_t app_count;                  /**< Applications launched in this session still running */
+    uint64_t idle_since_ms;            /**< CLOCK_MONOTONIC time the last application exited (or the start) */
+    uint64_t request_id;               /**< Trace ID of the launch that started the session */
+    uint64_t trace_start_ns;           /**< Start of the waypipe startup span */
+    struct session *next;              /**< Next live session */
+} session_t;
+
+/**
+ * @brief Build the waypipe transport flags of a profile
+ *
+ * Profiles producing the same flags share a session.
+ *
+ * @param profile The profile
+ * @param buffer Buffer to store the space-separated flags
+ * @param size Size of the buffer
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the flags don't fit
+ */
+int session_flags(const profile_t *profile, char *buffer, size_t size);
+
+/**
+ * @brief Spawn a waypipe server for a set of flags
+ *
+ * The returned session is STARTING; it becomes READY once the display
+ * socket shows up in the runtime directory.
+ *
+ * @param config The configuration (waypipe path and socket)
+ * @param flags Flags built by session_flags()
+ * @param display Wayland display name waypipe must create
+ * @return The session, or NULL on failure
+ */
+session_t *session_start(const config_t *config, const char *flags, const char *display);
+
+/**
+ * @brief Find the live session using the given flags
+ *
+ * @param sessions Head of the session list
+ * @param flags Flags built by session_flags()
+ * @return The session, or NULL if there is none
+ */
+session_t *session_find(session_t *sessions, const char *flags);
+
+/**
+ * @brief Ask a session's waypipe process group to terminate
+ *
+ * @param session The session
+ */
+void session_stop(const session_t *session);
+
+/**
+ * @brief Free a session
+ *
+ * The caller is responsible for closing the session's exit source first.
+ *
+ * @param session The session (can be NULL)
+ */
+void session_free(session_t *session);
+
+#endif //WAYPIPEDAEMON_SESSION_H
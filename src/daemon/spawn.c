@@ -0,0 +1,100 @@
+#include "spawn.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include "common/common.h"
+#include "common/logging.h"
+
+int open_pidfd(const pid_t pid) {
+    const long fd = syscall(SYS_pidfd_open, pid, 0);
+    if (fd < 0) {
+        perror("pidfd_open");
+        return -1;
+    }
+    return (int)fd;
+}
+
+/**
+ * Split a command line on whitespace, in place.
+ * Returns the number of arguments, 0 if there are none or too many.
+ */
+static size_t split_command(char *command, char *argv[], const size_t max_args) {
+    size_t argc = 0;
+    for (char *save = NULL, *arg = strtok_r(command, " \t\n", &save); arg; arg = strtok_r(NULL, " \t\n", &save)) {
+        if (argc + 1 >= max_args) return 0;
+        argv[argc++] = arg;
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+pid_t spawn_argv(char *const argv[], const spawn_options_t *options, int *exec_status_fd) {
+    int status_pipe[2];
+    if (pipe2(status_pipe, O_CLOEXEC) < 0) {
+        perror("pipe2");
+        return -1;
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(status_pipe[0]);
+        close(status_pipe[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        // The daemon blocks the signals it reads through signalfd and ignores SIGPIPE,
+        // don't let the application inherit that mask or the ignored disposition
+        sigset_t empty;
+        sigemptyset(&empty);
+        sigprocmask(SIG_SETMASK, &empty, NULL);
+        signal(SIGPIPE, SIG_DFL);
+        close(status_pipe[0]);
+        setsid();
+        if (options && options->wayland_display) setenv("WAYLAND_DISPLAY", options->wayland_display, 1);
+        if (options && options->priority && priority_is_set(options->priority)) priority_apply(options->priority);
+        execvp(argv[0], argv);
+        const int err = errno;
+        ssize_t ignored = write(status_pipe[1], &err, sizeof(err));
+        (void)ignored;
+        _exit(127);
+    }
+
+    close(status_pipe[1]);
+    *exec_status_fd = status_pipe[0];
+    return pid;
+}
+
+pid_t spawn_command(const char *command, const spawn_options_t *options, int *exec_status_fd) {
+    char command_buf[STANDARD_BUFFER_SIZE * 4];
+    if (snprintf(command_buf, sizeof(command_buf), "%s", command) >= (int)sizeof(command_buf)) {
+        log_err("Command too long to spawn");
+        return -1;
+    }
+    char *argv[SPAWN_MAX_ARGS];
+    if (split_command(command_buf, argv, SPAWN_MAX_ARGS) == 0) {
+        log_err("Invalid command: \"%s\"", command);
+        return -1;
+    }
+    return spawn_argv(argv, options, exec_status_fd);
+}
+
+int read_exec_status(const int exec_status_fd) {
+    int err = 0;
+    ssize_t length;
+    do {
+        length = read(exec_status_fd, &err, sizeof(err));
+    } while (length < 0 && errno == EINTR);
+    if (length < 0) {
+        perror("read");
+        return -1;
+    }
+    if (length == 0) return 0;
+    if (length < (ssize_t)sizeof(err)) return -1;
+    return err;
+}
@@ -0,0 +1,67 @@
+/**
+ * @file spawn.h
+ * @brief Launching applications on behalf of clients
+ */
+
+#ifndef WAYPIPEDAEMON_SPAWN_H
+#define WAYPIPEDAEMON_SPAWN_H
+#include <sys/types.h>
+#include "priority.h"
+
+/**
+ * @brief Maximum number of arguments of a launched command
+ */
+#define SPAWN_MAX_ARGS 256
+
+/**
+ * @brief Settings applied to the child between fork and exec
+ */
+typedef struct {
+    const char *wayland_display;  /**< WAYLAND_DISPLAY for the child, or NULL to inherit the daemon's */
+    const priority_t *priority;   /**< Scheduling settings for the child, or NULL to inherit the daemon's */
+} spawn_options_t;
+
+/**
+ * @brief Fork and exec an argument vector
+ *
+ * The child is executed through execvp() in a new session. The exec outcome
+ * is reported asynchronously through a close-on-exec pipe: end of file means
+ * the exec succeeded, an int holding errno means it failed.
+ *
+ * @param argv NULL-terminated argument vector
+ * @param options Settings for the child, or NULL for none
+ * @param exec_status_fd Set to the read end of the exec status pipe
+ * @return The child PID, or -1 on error
+ */
+pid_t spawn_argv(char *const argv[], const spawn_options_t *options, int *exec_status_fd);
+
+/**
+ * @brief Fork and exec a command line
+ *
+ * The command is split on whitespace (the client joins its arguments with
+ * single spaces) and passed to spawn_argv().
+ *
+ * @param command The command line
+ * @param options Settings for the child, or NULL for none
+ * @param exec_status_fd Set to the read end of the exec status pipe
+ * @return The child PID, or -1 on error
+ */
+pid_t spawn_command(const char *command, const spawn_options_t *options, int *exec_status_fd);
+
+/**
+ * @brief Read the outcome of an exec from its status pipe
+ *
+ * @param exec_status_fd The read end of the exec status pipe
+ * @return 0 if the exec succeeded, the child's errno if it failed, -1 on read error
+ */
+int read_exec_status(int exec_status_fd);
+
+/**
+ * @brief Obtain a pidfd for a process
+ *
+ * @param pid The process ID
+ * @return The pidfd (close-on-exec), or -1 on error
+ */
+int open_pidfd(pid_t pid);
+
+#endif //WAYPIPEDAEMON_SPAWN_H
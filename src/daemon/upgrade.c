@@ -0,0 +1,522 @@
+#include "upgrade.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "common/logging.h"
+#include "common/trace.h"
+
+/**
+ * Layout of the state: a header, the daemon record, the session records then
+ * the process records, each followed by its strings (uint32_t length, then
+ * the bytes). Both sides are the same machine, so fields are in native byte
+ * order.
+ *
+ * The header is the same in every version, so that any executable can at
+ * least take over the socket and answer the requester.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t listen_fd;
+    int32_t requester_fd;
+} upgrade_header_t;
+
+typedef struct {
+    uint32_t session_seq;
+    uint32_t session_count;
+    uint32_t process_count;
+    uint32_t trace_sequence;
+    priority_t app_priority;
+} upgrade_daemon_t;
+
+/* Followed by the flags and the display */
+typedef struct {
+    int32_t pid;
+    int32_t pidfd;
+    int32_t exec_status_fd;
+    uint32_t state;
+    uint64_t request_id;
+    uint64_t trace_start_ns;
+} upgrade_session_t;
+
+/* Followed by the key and the command */
+typedef struct {
+    int32_t pid;
+    int32_t pidfd;
+    int32_t exec_status_fd;
+    uint32_t session;  /* 1-based index of the session record, 0 for none */
+    uint64_t start_ms;
+    uint64_t spawn_us;
+    uint64_t request_id;
+} upgrade_process_t;
+
+typedef struct {
+    char *data;
+    size_t used;
+    size_t size;
+    bool failed;
+} state_writer_t;
+
+typedef struct {
+    const char *data;
+    size_t size;
+    size_t position;
+} state_reader_t;
+
+static void put(state_writer_t *writer, const void *data, const size_t length) {
+    if (writer->failed) return;
+    if (length > writer->size - writer->used) {
+        size_t size = writer->size ? writer->size : STANDARD_BUFFER_SIZE;
+        while (size - writer->used < length) size *= 2;
+        char *grown = realloc(writer->data, size);
+        if (!grown) {
+            perror("realloc");
+            writer->failed = true;
+            return;
+        }
+        writer->data = grown;
+        writer->size = size;
+    }
+    memcpy(writer->data + writer->used, data, length);
+    writer->used += length;
+}
+
+static void put_string(state_writer_t *writer, const char *string) {
+    const uint32_t length = (uint32_t)strlen(string);
+    put(writer, &length, sizeof(length));
+    put(writer, string, length);
+}
+
+static bool get(state_reader_t *reader, void *out, const size_t length) {
+    if (length > reader->size - reader->position) return false;
+    memcpy(out, reader->data + reader->position, length);
+    reader->position += length;
+    return true;
+}
+
+static char *get_string(state_reader_t *reader) {
+    uint32_t length;
+    if (!get(reader, &length, sizeof(length)) || length > reader->size - reader->position) return NULL;
+    char *string = malloc((size_t)length + 1);
+    if (!string) {
+        perror("malloc");
+        return NULL;
+    }
+    get(reader, string, length);
+    string[length] = '\0';
+    return string;
+}
+
+static void set_inherited(const int fd, const bool inherited) {
+    if (fd < 0) return;
+    const int flags = fcntl(fd, F_GETFD);
+    if (flags < 0 || fcntl(fd, F_SETFD, inherited ? flags & ~FD_CLOEXEC : flags | FD_CLOEXEC) < 0)
+        perror("fcntl(F_SETFD)");
+}
+
+/**
+ * Toggle FD_CLOEXEC on every file descriptor handed to the new executable.
+ */
+static void set_state_inherited(const daemon_t *daemon, session_t *const *sessions, const size_t session_count,
+                                const int requester_fd, const bool inherited) {
+    set_inherited(daemon->listen_source.fd, inherited);
+    set_inherited(requester_fd, inherited);
+    for (size_t i = 0; i < session_count; i++) {
+        set_inherited(sessions[i]->exit_source.fd, inherited);
+        set_inherited(sessions[i]->exec_status_fd, inherited);
+    }
+    for (const process_t *process = daemon->registry.head; process; process = process->next) {
+        set_inherited(process->exit_source.fd, inherited);
+        set_inherited(process->exec_source.fd, inherited);
+    }
+}
+
+static uint32_t session_index(session_t *const *sessions, const size_t count, const session_t *session) {
+    for (size_t i = 0; i < count; i++) {
+        if (sessions[i] == session) return (uint32_t)i + 1;
+    }
+    return 0;
+}
+
+/**
+ * Write the state into a memfd that survives the exec. Returns the memfd, or -1 on failure.
+ */
+static int write_state(const daemon_t *daemon, session_t *const *sessions, const size_t session_count,
+                       const int requester_fd) {
+    state_writer_t writer = {0};
+    const upgrade_header_t header = {
+        .magic = UPGRADE_MAGIC,
+        .version = UPGRADE_VERSION,
+        .listen_fd = daemon->listen_source.fd,
+        .requester_fd = requester_fd
+    };
+    const upgrade_daemon_t daemon_record = {
+        .session_seq = daemon->session_seq,
+        .session_count = (uint32_t)session_count,
+        .process_count = (uint32_t)daemon->registry.count,
+        .trace_sequence = trace_request_sequence(),
+        .app_priority = daemon->app_priority
+    };
+    put(&writer, &header, sizeof(header));
+    put(&writer, &daemon_record, sizeof(daemon_record));
+    for (size_t i = 0; i < session_count; i++) {
+        const session_t *session = sessions[i];
+        const upgrade_session_t record = {
+            .pid = session->pid,
+            .pidfd = session->exit_source.fd,
+            .exec_status_fd = session->exec_status_fd,
+            .state = session->state,
+            .request_id = session->request_id,
+            .trace_start_ns = session->trace_start_ns
+        };
+        put(&writer, &record, sizeof(record));
+        put_string(&writer, session->flags);
+        put_string(&writer, session->display);
+    }
+    for (const process_t *process = daemon->registry.head; process; process = process->next) {
+        const upgrade_process_t record = {
+            .pid = process->pid,
+            .pidfd = process->exit_source.fd,
+            .exec_status_fd = process->exec_source.fd,
+            .session = session_index(sessions, session_count, process->session),
+            .start_ms = process->start_ms,
+            .spawn_us = process->spawn_us,
+            .request_id = process->request_id
+        };
+        put(&writer, &record, sizeof(record));
+        put_string(&writer, process->key);
+        put_string(&writer, process->command);
+    }
+    if (writer.failed) {
+        free(writer.data);
+        return -1;
+    }
+
+    // Deliberately without MFD_CLOEXEC, the new executable reads it
+    const int fd = memfd_create("wdaemon-state", 0);
+    if (fd < 0) {
+        perror("memfd_create");
+        free(writer.data);
+        return -1;
+    }
+    for (size_t written = 0; written < writer.used;) {
+        const ssize_t length = write(fd, writer.data + written, writer.used - written);
+        if (length < 0) {
+            perror("write");
+            close(fd);
+            free(writer.data);
+            return -1;
+        }
+        written += (size_t)length;
+    }
+    free(writer.data);
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+        perror("lseek");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Read what a child writes to a pipe until it closes it, for at most CLIENT_TIMEOUT_MS.
+ * Returns the length read, or -1 on error or timeout.
+ */
+static ssize_t read_answer(const int fd, char *buffer, const size_t size) {
+    const uint64_t deadline_ms = monotonic_ms() + CLIENT_TIMEOUT_MS;
+    size_t used = 0;
+    for (;;) {
+        const uint64_t now = monotonic_ms();
+        if (now >= deadline_ms) return -1;
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        const int ready = poll(&pfd, 1, (int)(deadline_ms - now));
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready < 0) {
+            perror("poll");
+            return -1;
+        }
+        if (ready == 0) return -1;
+        const ssize_t length = read(fd, buffer + used, size - 1 - used);
+        if (length < 0 && errno == EINTR) continue;
+        if (length < 0) {
+            perror("read");
+            return -1;
+        }
+        if (length == 0 || (used += (size_t)length) == size - 1) break;
+    }
+    buffer[used] = '\0';
+    return (ssize_t)used;
+}
+
+/**
+ * Run the new executable with UPGRADE_CHECK_ARG before handing it anything: it
+ * must start, load the configuration and read this version of the state.
+ */
+static int check_executable(const char *path) {
+    int answer_pipe[2];
+    if (pipe2(answer_pipe, O_CLOEXEC) < 0) {
+        perror("pipe2");
+        return EXIT_FAILURE;
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(answer_pipe[0]);
+        close(answer_pipe[1]);
+        return EXIT_FAILURE;
+    }
+    if (pid == 0) {
+        if (dup2(answer_pipe[1], STDOUT_FILENO) < 0) _exit(127);
+        // dup2() onto itself keeps close-on-exec
+        if (answer_pipe[1] == STDOUT_FILENO) set_inherited(STDOUT_FILENO, true);
+        execv(path, (char *const[]){"wdaemon", UPGRADE_CHECK_ARG, NULL});
+        _exit(127);
+    }
+    close(answer_pipe[1]);
+    char answer[32];
+    const ssize_t length = read_answer(answer_pipe[0], answer, sizeof(answer));
+    close(answer_pipe[0]);
+    // A new executable hanging in its check must not hang the daemon
+    if (length < 0) kill(pid, SIGKILL);
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    if (length < 0) {
+        log_err("%s didn't answer its upgrade check", path);
+        return EXIT_FAILURE;
+    }
+    unsigned int version = 0;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS ||
+        sscanf(answer, UPGRADE_CHECK_ANSWER, &version) != 1) {
+        log_err("%s failed its upgrade check", path);
+        return EXIT_FAILURE;
+    }
+    if (version != UPGRADE_VERSION) {
+        log_err("%s reads upgrade state version %u, this executable writes version %u", path, version,
+                UPGRADE_VERSION);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int upgrade_check(void) {
+    printf(UPGRADE_CHECK_ANSWER "\n", UPGRADE_VERSION);
+    return fflush(stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int upgrade_exec(daemon_t *daemon, const int requester_fd) {
+    if (check_executable(daemon->exe_path) != EXIT_SUCCESS) return EXIT_FAILURE;
+    // Dead sessions are off the list but their applications still point at them,
+    // and sessions stopped while idle still have to be reaped
+    size_t session_count = 0;
+    for (const session_t *session = daemon->sessions; session; session = session->next) session_count++;
+    for (const session_t *session = daemon->dying_sessions; session; session = session->next) session_count++;
+    session_t **sessions = calloc(session_count + daemon->registry.count + 1, sizeof(session_t *));
+    if (!sessions) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    session_count = 0;
+    for (session_t *session = daemon->sessions; session; session = session->next) sessions[session_count++] = session;
+    for (session_t *session = daemon->dying_sessions; session; session = session->next)
+        sessions[session_count++] = session;
+    for (const process_t *process = daemon->registry.head; process; process = process->next) {
+        if (process->session && session_index(sessions, session_count, process->session) == 0)
+            sessions[session_count++] = process->session;
+    }
+
+    const int state_fd = write_state(daemon, sessions, session_count, requester_fd);
+    if (state_fd < 0) {
+        free(sessions);
+        return EXIT_FAILURE;
+    }
+    set_state_inherited(daemon, sessions, session_count, requester_fd, true);
+    char state_arg[16];
+    snprintf(state_arg, sizeof(state_arg), "%d", state_fd);
+    log_info("Upgrading: re-executing %s with %zu session(s) and %zu process(es)", daemon->exe_path, session_count,
+             daemon->registry.count);
+    execv(daemon->exe_path, (char *const[]){"wdaemon", UPGRADE_STATE_ARG, state_arg, NULL});
+    perror("execv");
+    set_state_inherited(daemon, sessions, session_count, requester_fd, false);
+    close(state_fd);
+    free(sessions);
+    return EXIT_FAILURE;
+}
+
+/**
+ * Read the whole state memfd. Returns a malloc'd buffer, or NULL on failure.
+ */
+static char *read_state(const int fd, size_t *size) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        return NULL;
+    }
+    *size = (size_t)st.st_size;
+    char *data = malloc(*size ? *size : 1);
+    if (!data) {
+        perror("malloc");
+        return NULL;
+    }
+    for (size_t received = 0; received < *size;) {
+        const ssize_t length = read(fd, data + received, *size - received);
+        if (length <= 0) {
+            if (length < 0) perror("read");
+            free(data);
+            return NULL;
+        }
+        received += (size_t)length;
+    }
+    return data;
+}
+
+static session_t *restore_session(daemon_t *daemon, state_reader_t *reader) {
+    upgrade_session_t record;
+    if (!get(reader, &record, sizeof(record))) return NULL;
+    session_t *session = calloc(1, sizeof(session_t));
+    char *display = NULL;
+    if (!session || !(session->flags = get_string(reader)) || !(display = get_string(reader))) {
+        if (session) free(session->flags);
+        free(session);
+        return NULL;
+    }
+    snprintf(session->display, sizeof(session->display), "%s", display);
+    free(display);
+    session->exit_source = (event_source_t){.kind = SOURCE_SESSION_EXIT, .fd = record.pidfd};
+    session->exec_status_fd = record.exec_status_fd;
+    session->pid = record.pid;
+    session->state = (session_state_t)record.state;
+    session->request_id = record.request_id;
+    session->trace_start_ns = record.trace_start_ns;
+    session->idle_since_ms = monotonic_ms();
+    set_inherited(session->exit_source.fd, false);
+    set_inherited(session->exec_status_fd, false);
+    if (session->exit_source.fd >= 0 && event_add(daemon->epfd, &session->exit_source, EPOLLIN) != EXIT_SUCCESS)
+        log_err("waypipe session %s will not be supervised", session->display);
+
+    if (session->state == SESSION_STARTING) {
+        // The display may have appeared while no watch existed
+        char path[SOCKET_PATH_MAX + SESSION_DISPLAY_MAX];
+        snprintf(path, sizeof(path), "%s/%s", daemon->runtime_dir, session->display);
+        if (access(path, F_OK) == 0) {
+            session->state = SESSION_READY;
+            if (session->exec_status_fd >= 0) close(session->exec_status_fd);
+            session->exec_status_fd = -1;
+        }
+    }
+    return session;
+}
+
+static bool restore_process(daemon_t *daemon, state_reader_t *reader, session_t *const *sessions,
+                            const size_t session_count) {
+    upgrade_process_t record;
+    if (!get(reader, &record, sizeof(record)) || record.session > session_count) return false;
+    char *key = get_string(reader);
+    char *command = key ? get_string(reader) : NULL;
+    process_t *process = command ? registry_add(&daemon->registry, record.pid, key, command) : NULL;
+    free(key);
+    free(command);
+    if (!process) return false;
+    process->start_ms = record.start_ms;
+    process->spawn_us = record.spawn_us;
+    process->request_id = record.request_id;
+    process->exec_source.fd = record.exec_status_fd;
+    process->exit_source.fd = record.pidfd;
+    set_inherited(process->exec_source.fd, false);
+    set_inherited(process->exit_source.fd, false);
+    if (record.session > 0) {
+        process->session = sessions[record.session - 1];
+        process->session->app_count++;
+    }
+    if (process->exec_source.fd >= 0 && event_add(daemon->epfd, &process->exec_source, EPOLLIN) != EXIT_SUCCESS)
+        event_close(daemon->epfd, &process->exec_source);
+    if (process->exit_source.fd < 0 || event_add(daemon->epfd, &process->exit_source, EPOLLIN) != EXIT_SUCCESS)
+        log_err("Process %d will not be supervised", (int)process->pid);
+    return true;
+}
+
+static void answer_requester(const int fd) {
+    if (fd < 0) return;
+    auto_free_message message_t *response = create_message(MSG_RESPONSE_OK, "Daemon upgraded",
+                                                           STRLENGTH_WITH_NULL("Daemon upgraded"));
+    if (!response || send_message(fd, response) != EXIT_SUCCESS)
+        log_warning("Failed to answer the upgrade request");
+    close(fd);
+}
+
+int upgrade_restore(daemon_t *daemon, const int state_fd) {
+    size_t size = 0;
+    char *data = read_state(state_fd, &size);
+    close(state_fd);
+    if (!data) return EXIT_FAILURE;
+
+    state_reader_t reader = {.data = data, .size = size, .position = 0};
+    upgrade_header_t header;
+    if (!get(&reader, &header, sizeof(header)) || header.magic != UPGRADE_MAGIC) {
+        log_err("Invalid upgrade state");
+        free(data);
+        return EXIT_FAILURE;
+    }
+    daemon->listen_source.fd = header.listen_fd;
+    set_inherited(daemon->listen_source.fd, false);
+    set_inherited(header.requester_fd, false);
+    if (header.version != UPGRADE_VERSION) {
+        log_warning("Unsupported upgrade state version %u, running applications are no longer supervised",
+                    header.version);
+        answer_requester(header.requester_fd);
+        free(data);
+        return EXIT_SUCCESS;
+    }
+    upgrade_daemon_t record = {0};
+    if (!get(&reader, &record, sizeof(record))) log_err("Truncated upgrade state");
+    daemon->session_seq = record.session_seq;
+    daemon->app_priority = record.app_priority;
+    // The PID stays the same, so must the request IDs already used
+    trace_resume_request_ids(record.trace_sequence);
+
+    session_t **sessions = calloc(record.session_count + 1u, sizeof(session_t *));
+    size_t session_count = 0;
+    size_t process_count = 0;
+    if (!sessions) perror("calloc");
+    while (sessions && session_count < record.session_count) {
+        session_t *session = restore_session(daemon, &reader);
+        if (!session) break;
+        sessions[session_count++] = session;
+    }
+    if (session_count == record.session_count) {
+        while (process_count < record.process_count && restore_process(daemon, &reader, sessions, session_count))
+            process_count++;
+    }
+    if (session_count < record.session_count || process_count < record.process_count)
+        log_err("Truncated upgrade state, some processes are no longer supervised");
+
+    // Keep the original order of the live sessions
+    for (size_t i = session_count; i > 0; i--) {
+        session_t *session = sessions[i - 1];
+        if (session->state == SESSION_DEAD && session->exit_source.fd >= 0) {
+            // Stopped while idle, reaped by this executable
+            session->next = daemon->dying_sessions;
+            daemon->dying_sessions = session;
+            continue;
+        }
+        if (session->state == SESSION_DEAD) {
+            if (session->app_count == 0) session_free(session);
+            continue;
+        }
+        session->next = daemon->sessions;
+        daemon->sessions = session;
+    }
+    free(sessions);
+    free(data);
+    log_info("Restored %zu session(s) and %zu process(es) after upgrade", session_count, process_count);
+    answer_requester(header.requester_fd);
+    return EXIT_SUCCESS;
+}
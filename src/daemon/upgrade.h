@@ -0,0 +1,69 @@
+/**
+ * @file upgrade.h
+ * @brief Live upgrade of the daemon by re-executing itself
+ *
+ * The daemon serializes its sessions and running processes into a memfd
+ * and execs its executable again, keeping the listening socket, pidfds and
+ * exec status pipes open across the exec. Clients connecting meanwhile wait
+ * in the listen backlog instead of failing, and launched applications keep
+ * their supervisor.
+ *
+ * Before that, the new executable is run once with UPGRADE_CHECK_ARG: if it
+ * fails to start, to load the configuration or to read this version of the
+ * state, the upgrade is refused and the running daemon carries on.
+ */
+
+#ifndef WAYPIPEDAEMON_UPGRADE_H
+#define WAYPIPEDAEMON_UPGRADE_H
+#include "daemon.h"
+
+/**
+ * @brief Argument passing the state memfd to the new executable
+ */
+#define UPGRADE_STATE_ARG "--restore"
+/**
+ * @brief Argument asking the new executable which state version it reads, see upgrade_check()
+ */
+#define UPGRADE_CHECK_ARG "--check-upgrade"
+#define UPGRADE_CHECK_ANSWER "state-version %u"
+#define UPGRADE_MAGIC 0x31555744u  /* "WDU1" */
+#define UPGRADE_VERSION 4u
+
+/**
+ * @brief Answer the upgrade check of the previous executable
+ *
+ * Called once the configuration loaded, prints the state version this
+ * executable reads on stdout.
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the answer couldn't be written
+ */
+int upgrade_check(void);
+
+/**
+ * @brief Check the new executable, serialize the daemon's state and re-exec
+ *
+ * Must be called with no client left but the one that requested the
+ * upgrade. On failure, including a failed check, everything is left as it
+ * was.
+ *
+ * @param daemon The daemon
+ * @param requester_fd Socket of the client to answer once upgraded, or -1
+ * @return EXIT_FAILURE (never returns on success)
+ */
+int upgrade_exec(daemon_t *daemon, int requester_fd);
+
+/**
+ * @brief Rebuild the state serialized by upgrade_exec()
+ *
+ * Restores the listening socket, the sessions and the registry, registers
+ * the inherited file descriptors with the epoll instance and answers the
+ * client that requested the upgrade. Must be called once the display watch
+ * exists so that no session display is missed.
+ *
+ * @param daemon The daemon, with its epoll instance and display watch created
+ * @param state_fd The memfd passed on the command line, closed by this call
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not even the socket could be restored
+ */
+int upgrade_restore(daemon_t *daemon, int state_fd);
+
+#endif //WAYPIPEDAEMON_UPGRADE_H
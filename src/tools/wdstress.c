@@ -0,0 +1,1016 @@
+/**
+ * @file wdstress.c
+ * @brief Load and soak test driver for wdaemon
+ *
+ * Usage: wdstress [options]
+ *
+ * Starts a private wdaemon (or targets a running one with --socket) and
+ * keeps a fixed number of simulated clients busy against it, framing every
+ * message with protocol.c. The clients are a weighted mix of:
+ *
+ * - pipelined: HELLO and SEND in a single write, like wdclient
+ * - sequential: HELLO, READY, then SEND
+ * - slow: sequential, but pausing before each read
+ * - truncated: part of a header, then hang up
+ * - stalled: part of a header, then wait for the daemon to drop them
+ *
+ * The private daemon runs a fake waypipe and fake applications, both this
+ * executable under another name (see main()). Each interval prints the
+ * launch throughput and latency percentiles with the daemon's fd count and
+ * RSS. At the end, once the daemon is idle again, its fds and RSS are
+ * compared with those before the load.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "common/common.h"
+#include "common/logging.h"
+#include "common/protocol.h"
+
+#define FAKE_WAYPIPE_NAME "waypipe"
+#define FAKE_APP_NAME "fake-app"
+#define STRESS_MAX_EVENTS 256
+#define CONNECT_RETRY_MS 10
+/**
+ * @brief How long a client may wait for its answer before counting as timed out
+ */
+#define STRESS_WATCHDOG_MS (3 * CLIENT_TIMEOUT_MS)
+/**
+ * @brief Log-linear latency buckets: 16 per power of two, about 6% wide
+ */
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_BUCKETS (64 << HISTOGRAM_SUB_BITS)
+
+// Logging configuration (overrides weak symbols from logging.c)
+const char *get_log_name(void) {
+    return "wdstress";
+}
+
+int get_log_facility(void) {
+    return LOG_USER;
+}
+
+// Per-message debug logs would cost more than the daemon under test
+int get_log_level(void) {
+    const char *verbose = getenv("WD_VERBOSE");
+    return verbose && verbose[0] != '\0' ? LOG_DEBUG : LOG_WARNING;
+}
+
+/**
+ * @brief Behaviour of a simulated client
+ */
+typedef enum {
+    KIND_PIPELINED,
+    KIND_SEQUENTIAL,
+    KIND_SLOW,
+    KIND_TRUNCATED,
+    KIND_STALLED,
+    KIND_COUNT
+} client_kind_t;
+
+static const char *const kind_names[KIND_COUNT] = {"pipelined", "sequential", "slow", "truncated", "stalled"};
+
+/**
+ * @brief Protocol step of a simulated client
+ */
+typedef enum {
+    STEP_IDLE,            /**< Not connected, waiting to connect */
+    STEP_READY,           /**< Waiting for READY */
+    STEP_RESPONSE,        /**< Waiting for the launch response */
+    STEP_PAUSE_READY,     /**< Slow client sleeping before reading READY */
+    STEP_PAUSE_RESPONSE,  /**< Slow client sleeping before reading the response */
+    STEP_DROP             /**< Stalled client waiting to be dropped */
+} client_step_t;
+
+typedef struct {
+    int fd;                   /**< Connection, -1 when idle */
+    size_t index;             /**< Slot of the client */
+    client_kind_t kind;       /**< Behaviour of the current connection */
+    client_step_t step;       /**< Protocol step */
+    bool watched;             /**< Registered with epoll */
+    message_reader_t reader;  /**< Partially received message */
+    uint64_t start_us;        /**< When the connection started */
+    uint64_t deadline_ms;     /**< Watchdog deadline */
+    uint64_t wake_ms;         /**< Pending timer, 0 for none */
+} sim_client_t;
+
+typedef struct {
+    uint64_t wake_ms;  /**< When the timer fires */
+    size_t index;      /**< Slot of the client */
+} timer_entry_t;
+
+typedef struct {
+    uint64_t counts[HISTOGRAM_BUCKETS];  /**< Values per bucket */
+    uint64_t total;                      /**< Number of values */
+    uint64_t max;                        /**< Highest value */
+} histogram_t;
+
+typedef struct {
+    uint64_t launches;         /**< Launches answered with success (pipelined and sequential) */
+    uint64_t slow_launches;    /**< Launches of slow clients answered with success */
+    uint64_t refused;          /**< Launches refused by admission control */
+    uint64_t errors;           /**< Unexpected answers, hang-ups or connection failures */
+    uint64_t timeouts;         /**< Clients the watchdog gave up on */
+    uint64_t truncated;        /**< Truncated requests sent */
+    uint64_t dropped;          /**< Stalled clients dropped by the daemon */
+    uint64_t dropped_ms;       /**< Total time stalled clients took to be dropped */
+    uint64_t connect_retries;  /**< Connections refused by a full backlog */
+    histogram_t latency;       /**< Launch latency in microseconds */
+} counters_t;
+
+typedef struct {
+    long fds;          /**< Open file descriptors, -1 if unknown */
+    long rss_kib;      /**< Resident set size, -1 if unknown */
+} daemon_sample_t;
+
+typedef struct {
+    unsigned int clients;              /**< Concurrent clients */
+    unsigned int duration_s;           /**< Length of the load, 0 until interrupted */
+    unsigned int interval_s;           /**< Time between reports */
+    unsigned int weights[KIND_COUNT];  /**< Share of each kind of client */
+    unsigned int slow_ms;              /**< Pause of slow clients before each read */
+    unsigned int app_ms;               /**< Lifetime of the fake applications */
+    const char *socket_path;           /**< Socket of a running daemon, or NULL to start one */
+} options_t;
+
+typedef struct {
+    options_t options;            /**< Command line options */
+    struct sockaddr_un address;   /**< Daemon socket */
+    char work_dir[64];            /**< Private XDG directories, removed at exit */
+    char command[PATH_MAX + 32];  /**< Command launched by every client */
+    pid_t daemon_pid;             /**< Daemon whose resources are sampled, -1 if unknown */
+    pid_t spawned_pid;            /**< Daemon we started, -1 if none */
+    int epfd;                     /**< Epoll instance watching the clients */
+    sim_client_t *clients;        /**< One slot per concurrent client */
+    timer_entry_t *timers;        /**< Min-heap of client timers */
+    size_t timer_count;           /**< Entries in the heap */
+    size_t timer_capacity;        /**< Allocated heap entries */
+    unsigned int weight_total;    /**< Sum of the mix weights */
+    bool loading;                 /**< Whether finished clients start again */
+    counters_t interval;          /**< Counters since the last report */
+    counters_t total;             /**< Counters of the previous intervals */
+    message_t *hello;             /**< Shared HELLO message */
+    message_t *send;              /**< Shared SEND message */
+} stress_t;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_signal(const int signo) {
+    (void)signo;
+    interrupted = 1;
+}
+
+static uint64_t elapsed_us(const uint64_t start_us) {
+    return monotonic_us() - start_us;
+}
+
+static void sleep_ms(const unsigned int ms) {
+    struct timespec ts = {.tv_sec = ms / 1000u, .tv_nsec = (long)(ms % 1000u) * 1000000L};
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {}
+}
+
+/* Fake waypipe and applications */
+
+/**
+ * Stand-in for `waypipe [flags] --display NAME server -- command...`:
+ * create the display, then run the keep-alive command.
+ */
+static int fake_waypipe(const int argc, char *argv[]) {
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--display") == 0 && i + 1 < argc && runtime_dir) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", runtime_dir, argv[i + 1]);
+            const int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+            if (fd >= 0) close(fd);
+        } else if (strcmp(argv[i], "--") == 0 && i + 1 < argc) {
+            execvp(argv[i + 1], &argv[i + 1]);
+            perror("execvp");
+            return EXIT_FAILURE;
+        }
+    }
+    pause();
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Stand-in for an application: live for the given number of milliseconds.
+ */
+static int fake_app(const int argc, char *argv[]) {
+    sleep_ms(argc > 1 ? (unsigned int)strtoul(argv[1], NULL, 10) : 0);
+    return EXIT_SUCCESS;
+}
+
+/* Latency histogram */
+
+static size_t histogram_index(const uint64_t value) {
+    if (value < (1u << HISTOGRAM_SUB_BITS)) return (size_t)value;
+    const unsigned int msb = 63u - (unsigned int)__builtin_clzll(value);
+    return (size_t)(msb - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS |
+           (size_t)((value >> (msb - HISTOGRAM_SUB_BITS)) & ((1u << HISTOGRAM_SUB_BITS) - 1));
+}
+
+/**
+ * Get the highest value falling in a bucket.
+ */
+static uint64_t histogram_bucket_max(const size_t index) {
+    if (index < (1u << HISTOGRAM_SUB_BITS)) return index;
+    const unsigned int shift = (unsigned int)(index >> HISTOGRAM_SUB_BITS) - 1;
+    const uint64_t low = ((uint64_t)(1u << HISTOGRAM_SUB_BITS) | (index & ((1u << HISTOGRAM_SUB_BITS) - 1))) << shift;
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+static void histogram_add(histogram_t *histogram, const uint64_t value) {
+    histogram->counts[histogram_index(value)]++;
+    histogram->total++;
+    if (value > histogram->max) histogram->max = value;
+}
+
+static uint64_t histogram_percentile(const histogram_t *histogram, const double percentile) {
+    if (histogram->total == 0) return 0;
+    const uint64_t rank = (uint64_t)((double)histogram->total * percentile / 100.0 + 0.5);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= (rank > 0 ? rank : 1)) {
+            const uint64_t value = histogram_bucket_max(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+static void counters_add(counters_t *into, const counters_t *from) {
+    into->launches += from->launches;
+    into->slow_launches += from->slow_launches;
+    into->refused += from->refused;
+    into->errors += from->errors;
+    into->timeouts += from->timeouts;
+    into->truncated += from->truncated;
+    into->dropped += from->dropped;
+    into->dropped_ms += from->dropped_ms;
+    into->connect_retries += from->connect_retries;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) into->latency.counts[i] += from->latency.counts[i];
+    into->latency.total += from->latency.total;
+    if (from->latency.max > into->latency.max) into->latency.max = from->latency.max;
+}
+
+/* Daemon resources */
+
+static long count_fds(const pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+    DIR *dir = opendir(path);
+    if (!dir) return -1;
+    long count = 0;
+    const struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] != '.') count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+static long resident_kib(const pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+    FILE *statm = fopen(path, "re");
+    if (!statm) return -1;
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    const int parsed = fscanf(statm, "%lu %lu", &size, &resident);
+    fclose(statm);
+    return parsed == 2 ? (long)(resident * (unsigned long)sysconf(_SC_PAGESIZE) / 1024u) : -1;
+}
+
+static daemon_sample_t sample_daemon(const stress_t *stress) {
+    if (stress->daemon_pid <= 0) return (daemon_sample_t){.fds = -1, .rss_kib = -1};
+    return (daemon_sample_t){.fds = count_fds(stress->daemon_pid), .rss_kib = resident_kib(stress->daemon_pid)};
+}
+
+/* Environment */
+
+static int remove_entry(const char *path, const struct stat *st, const int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    if (remove(path) < 0) perror("remove");
+    return 0;
+}
+
+/**
+ * Create a private runtime, configuration and state directory, with the
+ * fake waypipe and application linked to this executable.
+ */
+static int create_environment(stress_t *stress) {
+    char self[PATH_MAX];
+    const ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length < 0) {
+        perror("readlink");
+        return EXIT_FAILURE;
+    }
+    self[length] = '\0';
+
+    snprintf(stress->work_dir, sizeof(stress->work_dir), "/tmp/wdstress.XXXXXX");
+    if (!mkdtemp(stress->work_dir)) {
+        perror("mkdtemp");
+        stress->work_dir[0] = '\0';
+        return EXIT_FAILURE;
+    }
+    static const char *const directories[] = {"run", "bin", "state", "config", "config/waypipe-daemon"};
+    char path[PATH_MAX];
+    for (size_t i = 0; i < sizeof(directories) / sizeof(directories[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", stress->work_dir, directories[i]);
+        if (mkdir(path, 0700) < 0) {
+            perror("mkdir");
+            return EXIT_FAILURE;
+        }
+    }
+    static const char *const links[] = {FAKE_WAYPIPE_NAME, FAKE_APP_NAME};
+    for (size_t i = 0; i < sizeof(links) / sizeof(links[0]); i++) {
+        snprintf(path, sizeof(path), "%s/bin/%s", stress->work_dir, links[i]);
+        if (symlink(self, path) < 0) {
+            perror("symlink");
+            return EXIT_FAILURE;
+        }
+    }
+    snprintf(stress->command, sizeof(stress->command), "%s/bin/%s %u", stress->work_dir, FAKE_APP_NAME,
+             stress->options.app_ms);
+    if (stress->options.socket_path) return EXIT_SUCCESS;
+
+    // No admission limits or idle exit: measure the daemon, not its policies
+    snprintf(path, sizeof(path), "%s/config/waypipe-daemon/config", stress->work_dir);
+    FILE *config = fopen(path, "we");
+    if (!config) {
+        perror("fopen");
+        return EXIT_FAILURE;
+    }
+    fprintf(config,
+            "[daemon]\n"
+            "waypipe = %s/bin/%s\n"
+            "peer_launch_rate = 0\n"
+            "peer_max_inflight = 0\n"
+            "global_launch_rate = 0\n"
+            "global_max_inflight = 0\n"
+            "prefetch = 0\n"
+            "idle_session_timeout = 0\n"
+            "idle_exit_timeout = 0\n",
+            stress->work_dir, FAKE_WAYPIPE_NAME);
+    if (fclose(config) != 0) {
+        perror("fclose");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static void remove_environment(const stress_t *stress) {
+    if (stress->work_dir[0] == '\0') return;
+    nftw(stress->work_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/**
+ * Start wdaemon from this executable's directory on a socket of our own,
+ * the way wdclient does.
+ */
+static int start_daemon(stress_t *stress) {
+    char self[PATH_MAX];
+    const ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length < 0) {
+        perror("readlink");
+        return EXIT_FAILURE;
+    }
+    self[length] = '\0';
+    char daemon_path[PATH_MAX];
+    snprintf(daemon_path, sizeof(daemon_path), "%s/wdaemon", dirname(self));
+
+    const auto_close int listen_fd = create_listen_socket(stress->address.sun_path);
+    if (listen_fd < 0) return EXIT_FAILURE;
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    if (pid == 0) {
+        char variable[PATH_MAX];
+        static const char *const names[][2] = {
+            {"XDG_RUNTIME_DIR", "run"}, {"XDG_CONFIG_HOME", "config"}, {"XDG_STATE_HOME", "state"}
+        };
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            snprintf(variable, sizeof(variable), "%s/%s", stress->work_dir, names[i][1]);
+            setenv(names[i][0], variable, 1);
+        }
+        const char *verbose = getenv("WD_VERBOSE");
+        if (!verbose || verbose[0] == '\0') {
+            const int devnull = open("/dev/null", O_WRONLY);
+            if (devnull >= 0) {
+                dup2(devnull, STDOUT_FILENO);
+                dup2(devnull, STDERR_FILENO);
+                if (devnull > STDERR_FILENO) close(devnull);
+            }
+        }
+        if (fcntl(listen_fd, F_SETFD, 0) < 0) _exit(EXIT_FAILURE);
+        char fd_arg[16];
+        snprintf(fd_arg, sizeof(fd_arg), "%d", listen_fd);
+        execv(daemon_path, (char *const[]){"wdaemon", "--foreground", DAEMON_LISTEN_FD_ARG, fd_arg, NULL});
+        perror("execv");
+        _exit(EXIT_FAILURE);
+    }
+    stress->spawned_pid = pid;
+    stress->daemon_pid = pid;
+    return EXIT_SUCCESS;
+}
+
+static void stop_daemon(stress_t *stress) {
+    if (stress->spawned_pid <= 0) return;
+    kill(stress->spawned_pid, SIGTERM);
+    waitpid(stress->spawned_pid, NULL, 0);
+    stress->spawned_pid = -1;
+}
+
+/**
+ * Run one launch with blocking reads, like wdclient. Starts the waypipe
+ * session so that the baseline includes it.
+ */
+static int warm_up(stress_t *stress) {
+    const int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    const auto_close int fd = sockfd;
+    if (connect(fd, (const struct sockaddr *)&stress->address, sizeof(stress->address)) < 0) {
+        log_err("Failed to connect to %s: %s", stress->address.sun_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    const message_t *request[] = {stress->hello, stress->send};
+    if (send_messages(fd, request, 2) != EXIT_SUCCESS) return EXIT_FAILURE;
+    auto_free_message message_t *ready = read_message(fd);
+    auto_free_message message_t *response = ready ? read_message(fd) : NULL;
+    if (!ready || ready->header.type != MSG_READY || !response || response->header.type != MSG_RESPONSE_OK) {
+        log_err("Warm-up launch failed: %s",
+                response && response->header.length > 0 ? response->data : "no answer from the daemon");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Ask a daemon we didn't start for its PID, to watch its resources.
+ */
+static pid_t query_daemon_pid(const stress_t *stress) {
+    const int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) return -1;
+    const auto_close int fd = sockfd;
+    if (connect(fd, (const struct sockaddr *)&stress->address, sizeof(stress->address)) < 0) return -1;
+    auto_free_message message_t *stats = create_message(MSG_STATS, NULL, 0);
+    const message_t *request[] = {stress->hello, stats};
+    if (!stats || send_messages(fd, request, 2) != EXIT_SUCCESS) return -1;
+    auto_free_message message_t *ready = read_message(fd);
+    auto_free_message message_t *response = ready ? read_message(fd) : NULL;
+    int pid = -1;
+    if (!response || response->header.type != MSG_RESPONSE_OK || response->header.length == 0 ||
+        sscanf(response->data, "pid %d", &pid) != 1)
+        return -1;
+    return (pid_t)pid;
+}
+
+/* Timers, a binary min-heap; entries whose client re-armed or disarmed since are skipped */
+
+static void timer_arm(stress_t *stress, sim_client_t *client, const uint64_t wake_ms) {
+    if (stress->timer_count == stress->timer_capacity) {
+        const size_t capacity = stress->timer_capacity ? stress->timer_capacity * 2 : 1024;
+        timer_entry_t *grown = realloc(stress->timers, capacity * sizeof(timer_entry_t));
+        if (!grown) {
+            perror("realloc");
+            return;
+        }
+        stress->timers = grown;
+        stress->timer_capacity = capacity;
+    }
+    client->wake_ms = wake_ms;
+    size_t i = stress->timer_count++;
+    while (i > 0 && stress->timers[(i - 1) / 2].wake_ms > wake_ms) {
+        stress->timers[i] = stress->timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    stress->timers[i] = (timer_entry_t){.wake_ms = wake_ms, .index = client->index};
+}
+
+static timer_entry_t timer_pop(stress_t *stress) {
+    const timer_entry_t top = stress->timers[0];
+    const timer_entry_t last = stress->timers[--stress->timer_count];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= stress->timer_count) break;
+        if (child + 1 < stress->timer_count && stress->timers[child + 1].wake_ms < stress->timers[child].wake_ms)
+            child++;
+        if (stress->timers[child].wake_ms >= last.wake_ms) break;
+        stress->timers[i] = stress->timers[child];
+        i = child;
+    }
+    if (stress->timer_count > 0) stress->timers[i] = last;
+    return top;
+}
+
+/* Simulated clients */
+
+static void start_client(stress_t *stress, sim_client_t *client);
+
+static void watch(const stress_t *stress, sim_client_t *client, const bool on) {
+    if (client->watched == on) return;
+    struct epoll_event event = {.events = EPOLLIN | EPOLLRDHUP, .data.ptr = client};
+    if (epoll_ctl(stress->epfd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, client->fd, &event) < 0) perror("epoll_ctl");
+    else client->watched = on;
+}
+
+/**
+ * Close the connection and start the next one in the same slot.
+ */
+static void finish_client(stress_t *stress, sim_client_t *client) {
+    watch(stress, client, false);
+    if (client->fd >= 0) close(client->fd);
+    client->fd = -1;
+    client->step = STEP_IDLE;
+    client->wake_ms = 0;
+    message_reader_reset(&client->reader);
+    if (stress->loading) start_client(stress, client);
+}
+
+static void fail_client(stress_t *stress, sim_client_t *client, const char *reason) {
+    log_debug("%s client failed: %s", kind_names[client->kind], reason);
+    stress->interval.errors++;
+    finish_client(stress, client);
+}
+
+/**
+ * Sleep before the next read: the connection is left unwatched, or a hang-up would wake us up in a loop.
+ */
+static void pause_client(stress_t *stress, sim_client_t *client, const client_step_t step) {
+    client->step = step;
+    watch(stress, client, false);
+    timer_arm(stress, client, monotonic_ms() + stress->options.slow_ms);
+}
+
+static client_kind_t pick_kind(const stress_t *stress) {
+    unsigned int draw = (unsigned int)rand() % stress->weight_total;
+    for (int kind = 0; kind < KIND_COUNT; kind++) {
+        if (draw < stress->options.weights[kind]) return (client_kind_t)kind;
+        draw -= stress->options.weights[kind];
+    }
+    return KIND_PIPELINED;
+}
+
+static void start_client(stress_t *stress, sim_client_t *client) {
+    client->kind = pick_kind(stress);
+    client->start_us = monotonic_us();
+    client->deadline_ms = monotonic_ms() + STRESS_WATCHDOG_MS + 2u * stress->options.slow_ms;
+    client->wake_ms = 0;
+    client->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (client->fd < 0) {
+        perror("socket");
+        stress->interval.errors++;
+        timer_arm(stress, client, monotonic_ms() + CONNECT_RETRY_MS);
+        return;
+    }
+    if (connect(client->fd, (const struct sockaddr *)&stress->address, sizeof(stress->address)) < 0) {
+        // A full backlog: the daemon is behind, try again shortly
+        if (errno == EAGAIN) stress->interval.connect_retries++;
+        else stress->interval.errors++;
+        close(client->fd);
+        client->fd = -1;
+        timer_arm(stress, client, monotonic_ms() + CONNECT_RETRY_MS);
+        return;
+    }
+
+    int status = EXIT_SUCCESS;
+    switch (client->kind) {
+    case KIND_PIPELINED: {
+        const message_t *request[] = {stress->hello, stress->send};
+        status = send_messages(client->fd, request, 2);
+        client->step = STEP_READY;
+        break;
+    }
+    case KIND_SEQUENTIAL:
+    case KIND_SLOW:
+        status = send_message(client->fd, stress->hello);
+        client->step = STEP_READY;
+        break;
+    case KIND_TRUNCATED:
+    case KIND_STALLED: {
+        // A header cut short, never completed
+        const size_t length = 1 + (size_t)rand() % (sizeof(message_header_t) - 1);
+        if (send(client->fd, stress->send, length, MSG_NOSIGNAL) != (ssize_t)length) status = EXIT_FAILURE;
+        client->step = STEP_DROP;
+        break;
+    }
+    case KIND_COUNT:
+        break;
+    }
+    if (status != EXIT_SUCCESS) {
+        fail_client(stress, client, "failed to send the request");
+        return;
+    }
+    if (client->kind == KIND_TRUNCATED) {
+        stress->interval.truncated++;
+        finish_client(stress, client);
+        return;
+    }
+    if (client->kind == KIND_SLOW) pause_client(stress, client, STEP_PAUSE_READY);
+    else watch(stress, client, true);
+}
+
+/**
+ * Handle a complete message. Returns false once the client stops reading.
+ */
+static bool handle_message(stress_t *stress, sim_client_t *client, const message_t *msg) {
+    if (client->step == STEP_READY) {
+        if (msg->header.type != MSG_READY) {
+            fail_client(stress, client, "expected READY");
+            return false;
+        }
+        client->step = STEP_RESPONSE;
+        if (client->kind == KIND_PIPELINED) return true;
+        if (send_message(client->fd, stress->send) != EXIT_SUCCESS) {
+            fail_client(stress, client, "failed to send the command");
+            return false;
+        }
+        if (client->kind == KIND_SLOW) {
+            pause_client(stress, client, STEP_PAUSE_RESPONSE);
+            return false;
+        }
+        return true;
+    }
+    if (client->step != STEP_RESPONSE) {
+        fail_client(stress, client, "unexpected message");
+        return false;
+    }
+    if (msg->header.type == MSG_RESPONSE_OK) {
+        if (client->kind == KIND_SLOW) {
+            stress->interval.slow_launches++;
+        } else {
+            stress->interval.launches++;
+            histogram_add(&stress->interval.latency, elapsed_us(client->start_us));
+        }
+    } else if (msg->header.type == MSG_RESPONSE_ERROR && msg->header.length > 0 && strstr(msg->data, "retry")) {
+        stress->interval.refused++;
+    } else {
+        fail_client(stress, client, msg->header.length > 0 ? msg->data : "error response");
+        return false;
+    }
+    finish_client(stress, client);
+    return false;
+}
+
+static void handle_client_event(stress_t *stress, sim_client_t *client) {
+    for (;;) {
+        message_t *msg = NULL;
+        const message_reader_status_t status = message_reader_feed(&client->reader, client->fd, &msg);
+        if (status == MESSAGE_READER_AGAIN) return;
+        if (status != MESSAGE_READER_DONE) {
+            if (client->step != STEP_DROP) {
+                fail_client(stress, client, "connection closed early");
+                return;
+            }
+            stress->interval.dropped++;
+            stress->interval.dropped_ms += elapsed_us(client->start_us) / 1000u;
+            finish_client(stress, client);
+            return;
+        }
+        const bool keep = handle_message(stress, client, msg);
+        free_message(msg);
+        if (!keep) return;
+    }
+}
+
+static void handle_timer(stress_t *stress, sim_client_t *client) {
+    client->wake_ms = 0;
+    switch (client->step) {
+    case STEP_IDLE:
+        if (stress->loading) start_client(stress, client);
+        break;
+    case STEP_PAUSE_READY:
+        client->step = STEP_READY;
+        watch(stress, client, true);
+        break;
+    case STEP_PAUSE_RESPONSE:
+        client->step = STEP_RESPONSE;
+        watch(stress, client, true);
+        break;
+    case STEP_READY:
+    case STEP_RESPONSE:
+    case STEP_DROP:
+        break;
+    }
+}
+
+static void run_timers(stress_t *stress, const uint64_t now) {
+    while (stress->timer_count > 0 && stress->timers[0].wake_ms <= now) {
+        const timer_entry_t entry = timer_pop(stress);
+        sim_client_t *client = &stress->clients[entry.index];
+        if (client->wake_ms == entry.wake_ms) handle_timer(stress, client);
+    }
+}
+
+static void check_watchdogs(stress_t *stress, const uint64_t now) {
+    for (unsigned int i = 0; i < stress->options.clients; i++) {
+        sim_client_t *client = &stress->clients[i];
+        if (client->fd < 0 || client->deadline_ms > now) continue;
+        log_debug("%s client timed out", kind_names[client->kind]);
+        stress->interval.timeouts++;
+        finish_client(stress, client);
+    }
+}
+
+/* Reporting */
+
+static void format_latency(char *buffer, const size_t size, const uint64_t us) {
+    if (us < 1000u) snprintf(buffer, size, "%" PRIu64 "us", us);
+    else snprintf(buffer, size, "%.2fms", (double)us / 1000.0);
+}
+
+static void print_counters(const counters_t *counters, const double seconds, const daemon_sample_t *sample) {
+    char p50[32], p99[32], p999[32], max[32];
+    format_latency(p50, sizeof(p50), histogram_percentile(&counters->latency, 50.0));
+    format_latency(p99, sizeof(p99), histogram_percentile(&counters->latency, 99.0));
+    format_latency(p999, sizeof(p999), histogram_percentile(&counters->latency, 99.9));
+    format_latency(max, sizeof(max), counters->latency.max);
+    printf("%9" PRIu64 " launches %8.0f/s  p50 %-8s p99 %-8s p99.9 %-8s max %-8s  slow %" PRIu64 " refused %" PRIu64
+           " errors %" PRIu64 " timeouts %" PRIu64 " truncated %" PRIu64 " dropped %" PRIu64 " retries %" PRIu64
+           "  fds %ld rss %ld KiB\n",
+           counters->launches, seconds > 0 ? (double)counters->launches / seconds : 0.0, p50, p99, p999, max,
+           counters->slow_launches, counters->refused, counters->errors, counters->timeouts, counters->truncated,
+           counters->dropped, counters->connect_retries, sample->fds, sample->rss_kib);
+}
+
+/* Setup */
+
+static int parse_uint_option(const char *value, unsigned int *out) {
+    char *end = NULL;
+    errno = 0;
+    const unsigned long parsed = strtoul(value, &end, 10);
+    if (errno || end == value || *end != '\0' || parsed > UINT_MAX || value[0] == '-') {
+        log_err("Invalid number: %s", value);
+        return EXIT_FAILURE;
+    }
+    *out = (unsigned int)parsed;
+    return EXIT_SUCCESS;
+}
+
+static int parse_mix(const char *value, unsigned int weights[KIND_COUNT]) {
+    char buffer[STANDARD_BUFFER_SIZE];
+    snprintf(buffer, sizeof(buffer), "%s", value);
+    int kind = 0;
+    for (char *save = NULL, *weight = strtok_r(buffer, ",", &save); weight; weight = strtok_r(NULL, ",", &save)) {
+        if (kind == KIND_COUNT || parse_uint_option(weight, &weights[kind++]) != EXIT_SUCCESS) return EXIT_FAILURE;
+    }
+    return kind == KIND_COUNT ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int parse_options(const int argc, char *argv[], options_t *options) {
+    *options = (options_t){
+        .clients = 1000, .duration_s = 60, .interval_s = 5, .weights = {60, 20, 10, 5, 5}, .slow_ms = 1000,
+        .app_ms = 100
+    };
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        int status = EXIT_FAILURE;
+        if (!value) status = EXIT_FAILURE;
+        else if (strcmp(arg, "-c") == 0 || strcmp(arg, "--clients") == 0)
+            status = parse_uint_option(value, &options->clients);
+        else if (strcmp(arg, "-d") == 0 || strcmp(arg, "--duration") == 0)
+            status = parse_uint_option(value, &options->duration_s);
+        else if (strcmp(arg, "-i") == 0 || strcmp(arg, "--interval") == 0)
+            status = parse_uint_option(value, &options->interval_s);
+        else if (strcmp(arg, "--mix") == 0) status = parse_mix(value, options->weights);
+        else if (strcmp(arg, "--slow-ms") == 0) status = parse_uint_option(value, &options->slow_ms);
+        else if (strcmp(arg, "--app-ms") == 0) status = parse_uint_option(value, &options->app_ms);
+        else if (strcmp(arg, "--socket") == 0) {
+            options->socket_path = value;
+            status = EXIT_SUCCESS;
+        }
+        if (status != EXIT_SUCCESS) {
+            log_err("Invalid argument: %s\nUsage: %s [--clients N] [--duration S] [--interval S] "
+                    "[--mix PIPELINED,SEQUENTIAL,SLOW,TRUNCATED,STALLED] [--slow-ms MS] [--app-ms MS] "
+                    "[--socket PATH]", arg, argv[0]);
+            return EXIT_FAILURE;
+        }
+        i++;
+    }
+    if (options->clients == 0 || options->interval_s == 0) {
+        log_err("--clients and --interval must be positive");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Raise the open file limit for the simulated clients; the daemon we start inherits it.
+ */
+static void raise_fd_limit(options_t *options) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) return;
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0) perror("setrlimit");
+    getrlimit(RLIMIT_NOFILE, &limit);
+    const rlim_t needed = (rlim_t)options->clients + 64;
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < needed) {
+        options->clients = limit.rlim_cur > 128 ? (unsigned int)(limit.rlim_cur - 64) : 64;
+        log_warning("Open file limit too low, running %u clients", options->clients);
+    }
+}
+
+static int setup(stress_t *stress) {
+    if (create_environment(stress) != EXIT_SUCCESS) return EXIT_FAILURE;
+    stress->address.sun_family = AF_UNIX;
+    int written;
+    if (stress->options.socket_path)
+        written = snprintf(stress->address.sun_path, sizeof(stress->address.sun_path), "%s",
+                           stress->options.socket_path);
+    else
+        written = snprintf(stress->address.sun_path, sizeof(stress->address.sun_path), "%s/run/%s",
+                           stress->work_dir, DAEMON_INT_SOCK);
+    if (written < 0 || (size_t)written >= sizeof(stress->address.sun_path)) {
+        log_err("Socket path too long");
+        return EXIT_FAILURE;
+    }
+    stress->hello = create_message(MSG_HELLO, NULL, 0);
+    stress->send = create_message(MSG_SEND, stress->command, STRLENGTH_WITH_NULL(stress->command));
+    if (!stress->hello || !stress->send) return EXIT_FAILURE;
+    if (stress->options.socket_path) {
+        stress->daemon_pid = query_daemon_pid(stress);
+        if (stress->daemon_pid <= 0) log_warning("Unknown daemon PID, not tracking its resources");
+    } else if (start_daemon(stress) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (warm_up(stress) != EXIT_SUCCESS) return EXIT_FAILURE;
+    stress->clients = calloc(stress->options.clients, sizeof(sim_client_t));
+    stress->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (!stress->clients || stress->epfd < 0) {
+        perror("setup");
+        return EXIT_FAILURE;
+    }
+    for (unsigned int i = 0; i < KIND_COUNT; i++) stress->weight_total += stress->options.weights[i];
+    if (stress->weight_total == 0) {
+        log_err("The client mix has no weight");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static void teardown(stress_t *stress) {
+    if (stress->clients) {
+        for (unsigned int i = 0; i < stress->options.clients; i++) {
+            if (stress->clients[i].fd >= 0) close(stress->clients[i].fd);
+            message_reader_reset(&stress->clients[i].reader);
+        }
+    }
+    free(stress->clients);
+    free(stress->timers);
+    if (stress->epfd >= 0) close(stress->epfd);
+    free_message(stress->hello);
+    free_message(stress->send);
+    stop_daemon(stress);
+    remove_environment(stress);
+}
+
+/**
+ * Whether the daemon we started is still alive.
+ */
+static bool daemon_alive(stress_t *stress) {
+    if (stress->spawned_pid <= 0) return true;
+    int status = 0;
+    if (waitpid(stress->spawned_pid, &status, WNOHANG) != stress->spawned_pid) return true;
+    log_err("The daemon died (%s %d)", WIFSIGNALED(status) ? "signal" : "status",
+            WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+    stress->spawned_pid = -1;
+    stress->daemon_pid = -1;
+    return false;
+}
+
+static int run(stress_t *stress) {
+    const options_t *options = &stress->options;
+    struct epoll_event events[STRESS_MAX_EVENTS];
+    const uint64_t start_ms = monotonic_ms();
+    const uint64_t end_ms = options->duration_s > 0 ? start_ms + (uint64_t)options->duration_s * 1000u : UINT64_MAX;
+    uint64_t report_ms = start_ms + (uint64_t)options->interval_s * 1000u;
+    uint64_t interval_start_ms = start_ms;
+    uint64_t watchdog_ms = start_ms + 1000u;
+
+    stress->loading = true;
+    for (unsigned int i = 0; i < options->clients; i++) {
+        stress->clients[i] = (sim_client_t){.fd = -1, .index = i};
+        message_reader_init(&stress->clients[i].reader);
+        start_client(stress, &stress->clients[i]);
+    }
+    while (!interrupted) {
+        uint64_t now = monotonic_ms();
+        if (now >= end_ms) break;
+        uint64_t wake_ms = report_ms < end_ms ? report_ms : end_ms;
+        if (watchdog_ms < wake_ms) wake_ms = watchdog_ms;
+        if (stress->timer_count > 0 && stress->timers[0].wake_ms < wake_ms) wake_ms = stress->timers[0].wake_ms;
+        const int count = epoll_wait(stress->epfd, events, STRESS_MAX_EVENTS, wake_ms > now ? (int)(wake_ms - now) : 0);
+        if (count < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < count; i++) {
+            sim_client_t *client = events[i].data.ptr;
+            // Hung up and restarted earlier in this batch
+            if (client->fd >= 0 && client->watched) handle_client_event(stress, client);
+        }
+        now = monotonic_ms();
+        run_timers(stress, now);
+        if (now >= watchdog_ms) {
+            check_watchdogs(stress, now);
+            watchdog_ms = now + 1000u;
+        }
+        if (now >= report_ms) {
+            const daemon_sample_t sample = sample_daemon(stress);
+            printf("%7.1fs ", (double)(now - start_ms) / 1000.0);
+            print_counters(&stress->interval, (double)(now - interval_start_ms) / 1000.0, &sample);
+            fflush(stdout);
+            counters_add(&stress->total, &stress->interval);
+            memset(&stress->interval, 0, sizeof(stress->interval));
+            interval_start_ms = now;
+            report_ms = now + (uint64_t)options->interval_s * 1000u;
+            if (!daemon_alive(stress)) return EXIT_FAILURE;
+        }
+    }
+    stress->loading = false;
+    counters_add(&stress->total, &stress->interval);
+    for (unsigned int i = 0; i < options->clients; i++) {
+        if (stress->clients[i].fd >= 0) finish_client(stress, &stress->clients[i]);
+    }
+    const double seconds = (double)(monotonic_ms() - start_ms) / 1000.0;
+    const daemon_sample_t sample = sample_daemon(stress);
+    printf("  total  ");
+    print_counters(&stress->total, seconds, &sample);
+    if (stress->total.dropped > 0)
+        printf("stalled clients dropped after %" PRIu64 "ms on average (client timeout %dms)\n",
+               stress->total.dropped_ms / stress->total.dropped, CLIENT_TIMEOUT_MS);
+    return stress->total.errors > 0 || stress->total.timeouts > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(const int argc, char *argv[]) {
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s", argv[0]);
+    const char *invoked_as = basename(name);
+    if (strcmp(invoked_as, FAKE_WAYPIPE_NAME) == 0) return fake_waypipe(argc, argv);
+    if (strcmp(invoked_as, FAKE_APP_NAME) == 0) return fake_app(argc, argv);
+
+    stress_t stress = {.daemon_pid = -1, .spawned_pid = -1, .epfd = -1};
+    if (parse_options(argc, argv, &stress.options) != EXIT_SUCCESS) return EXIT_FAILURE;
+    raise_fd_limit(&stress.options);
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction action = {.sa_handler = on_signal};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    srand((unsigned int)getpid());
+
+    int status = setup(&stress);
+    if (status == EXIT_SUCCESS) {
+        // Let the warm-up application exit before taking the baseline
+        sleep_ms(stress.options.app_ms + 200u);
+        const daemon_sample_t baseline = sample_daemon(&stress);
+        printf("daemon pid %d, %u clients, mix", (int)stress.daemon_pid, stress.options.clients);
+        for (int kind = 0; kind < KIND_COUNT; kind++)
+            printf(" %s=%u", kind_names[kind], stress.options.weights[kind]);
+        printf(", baseline fds %ld rss %ld KiB\n", baseline.fds, baseline.rss_kib);
+        fflush(stdout);
+
+        status = run(&stress);
+        // Let the daemon notice the hang-ups and reap the applications
+        sleep_ms(stress.options.app_ms + 1000u);
+        const daemon_sample_t idle = sample_daemon(&stress);
+        printf("daemon once idle: fds %ld (%+ld), rss %ld KiB (%+ld KiB)\n", idle.fds, idle.fds - baseline.fds,
+               idle.rss_kib, idle.rss_kib - baseline.rss_kib);
+        // A daemon we didn't start may be serving other clients meanwhile
+        if (stress.spawned_pid > 0 && baseline.fds >= 0 && idle.fds > baseline.fds) {
+            log_err("The daemon holds %ld more file descriptor(s) than before the load", idle.fds - baseline.fds);
+            status = EXIT_FAILURE;
+        }
+    }
+    teardown(&stress);
+    closelog();
+    return status;
+}
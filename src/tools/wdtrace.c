@@ -0,0 +1,144 @@
+/**
+ * @file wdtrace.c
+ * @brief Convert the trace files written under WD_TRACE to Chrome trace JSON
+ *
+ * Usage: wdtrace [--request ID] FILE... > trace.json
+ *
+ * The output loads in chrome://tracing or ui.perfetto.dev. Each span keeps
+ * its request ID in its arguments; --request keeps a single launch.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common/common.h"
+#include "common/logging.h"
+#include "common/trace.h"
+
+// Logging configuration (overrides weak symbols from logging.c)
+const char *get_log_name(void) {
+    return "wdtrace";
+}
+
+int get_log_facility(void) {
+    return LOG_USER;
+}
+
+/**
+ * Write a string as a JSON string literal.
+ */
+static void print_json_string(const char *string, const size_t max) {
+    putchar('"');
+    for (size_t i = 0; i < max && string[i] != '\0'; i++) {
+        const unsigned char c = (unsigned char)string[i];
+        if (c == '"' || c == '\\') printf("\\%c", c);
+        else if (c < 0x20) printf("\\u%04x", c);
+        else putchar(c);
+    }
+    putchar('"');
+}
+
+/**
+ * Print the events of one trace file. Returns the number of spans printed, or -1 on failure.
+ */
+static long export_file(const char *path, const bool filter, const uint64_t request_id, bool *first) {
+    const auto_close int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_err("Failed to open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        return -1;
+    }
+    const size_t size = (size_t)st.st_size;
+    if (size < sizeof(trace_file_t)) {
+        log_err("%s is not a trace file", path);
+        return -1;
+    }
+    const trace_file_t *file = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (file == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    if (file->magic != TRACE_MAGIC || file->version != TRACE_VERSION ||
+        (size - sizeof(trace_file_t)) / sizeof(trace_record_t) < file->capacity || file->capacity == 0) {
+        log_err("%s is not a trace file", path);
+        munmap((void *)file, size);
+        return -1;
+    }
+
+    printf("%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":", *first ? "" : ",", file->pid);
+    print_json_string(file->process, sizeof(file->process));
+    printf("}}");
+    *first = false;
+
+    // Oldest first: once the ring wrapped, the oldest span is the next one overwritten
+    const uint64_t count = file->next < file->capacity ? file->next : file->capacity;
+    const uint64_t oldest = file->next - count;
+    long printed = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        const trace_record_t *record = &file->records[(oldest + i) % file->capacity];
+        if (record->start_ns == 0 || record->end_ns < record->start_ns) continue;
+        if (filter && record->request_id != request_id) continue;
+        const uint64_t duration_ns = record->end_ns - record->start_ns;
+        // Chrome wants microseconds, keep the nanoseconds as decimals
+        printf(",\n{\"name\":");
+        print_json_string(record->name, sizeof(record->name));
+        printf(",\"cat\":");
+        print_json_string(file->process, sizeof(file->process));
+        printf(",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%" PRIu64 ".%03" PRIu64 ",\"dur\":%" PRIu64 ".%03" PRIu64
+               ",\"args\":{\"request\":\"%016" PRIx64 "\"}}",
+               file->pid, file->pid, record->start_ns / 1000u, record->start_ns % 1000u, duration_ns / 1000u,
+               duration_ns % 1000u, record->request_id);
+        printed++;
+    }
+    munmap((void *)file, size);
+    return printed;
+}
+
+int main(const int argc, char *argv[]) {
+    bool filter = false;
+    uint64_t request_id = 0;
+    int first_file = 1;
+    if (argc > 2 && (strcmp(argv[1], "-r") == 0 || strcmp(argv[1], "--request") == 0)) {
+        char *end = NULL;
+        request_id = strtoull(argv[2], &end, 16);
+        if (*end != '\0') {
+            log_err("Invalid request ID: %s", argv[2]);
+            return EXIT_FAILURE;
+        }
+        filter = true;
+        first_file = 3;
+    }
+    if (first_file >= argc) {
+        log_err("Missing trace files\nUsage: %s [--request ID] FILE...", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    bool first = true;
+    long spans = 0;
+    printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (int i = first_file; i < argc; i++) {
+        const long printed = export_file(argv[i], filter, request_id, &first);
+        if (printed < 0) status = EXIT_FAILURE;
+        else spans += printed;
+    }
+    printf("\n]}\n");
+    if (fflush(stdout) != 0) {
+        perror("fflush");
+        status = EXIT_FAILURE;
+    }
+    log_info("Exported %ld span(s)", spans);
+    closelog();
+    return status;
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Usage: admission.sh WDCLIENT STUB_WAYPIPE
+#
+# Sets a peer launch rate of one per second with a burst of two, then checks
+# that a third launch in a row is refused with a retry delay and that a
+# launch after that delay is admitted.
+set -eu
+wdclient=$1
+stub=$2
+
+. "$(dirname "$0")/common.sh"
+
+cat > "$config" <<CONFIG
+[daemon]
+waypipe = $stub
+prefetch = 0
+peer_launch_rate = 1
+peer_launch_burst = 2
+CONFIG
+
+"$wdclient" true
+track_daemon "$wdclient"
+"$wdclient" true
+if "$wdclient" true 2> "$dir/refused"; then fail "third launch in a row admitted"; fi
+retry_ms=$(sed -n 's/.*Too many launches, retry later (retry-after=\([0-9]*\)ms).*/\1/p' "$dir/refused")
+[ -n "$retry_ms" ] || fail "no retry-after in the refusal: $(cat "$dir/refused")"
+[ "$retry_ms" -gt 0 ] && [ "$retry_ms" -le 1000 ] || fail "retry-after=${retry_ms}ms, expected up to one second"
+
+sleep "$(awk "BEGIN { print $retry_ms / 1000 + 0.05 }")"
+"$wdclient" true || fail "launch refused after its retry delay"
+echo "refused with retry-after=${retry_ms}ms, admitted after it"
@@ -0,0 +1,53 @@
+# Sourced by the tests: a private daemon environment in a temporary
+# directory, removed on exit along with the daemon started in it.
+# The configuration goes to $config; call track_daemon once wdclient has
+# started the daemon so that it is stopped at the end, or start it with
+# start_daemon to keep its log.
+
+dir=$(mktemp -d)
+daemon_pid=
+cleanup() {
+    if [ -n "$daemon_pid" ] && kill "$daemon_pid" 2>/dev/null; then
+        # Let it stop its sessions before removing their directory
+        while kill -0 "$daemon_pid" 2>/dev/null; do sleep 0.1; done
+    fi
+    rm -rf "$dir"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+# Usage: track_daemon WDCLIENT
+track_daemon() {
+    daemon_pid=$("$1" --stats | sed -n 's/^pid //p')
+    [ -n "$daemon_pid" ] || fail "no daemon pid in the stats"
+}
+
+# Usage: start_daemon WDCLIENT
+# Runs the wdaemon next to wdclient in the foreground, logging to $daemon_log
+# (wdclient discards the output of the daemons it starts)
+start_daemon() {
+    "$(dirname "$1")/wdaemon" --foreground 2> "$daemon_log" &
+    daemon_pid=$!
+    tries=0
+    until "$1" --stats > /dev/null 2>&1; do
+        tries=$((tries + 1))
+        [ "$tries" -lt 50 ] || fail "the daemon didn't start"
+        sleep 0.1
+    done
+}
+
+# Usage: stat NAME
+# Prints a counter of wdclient --stats
+stat() {
+    "$wdclient" --stats | sed -n "s/^$1 //p"
+}
+
+export XDG_RUNTIME_DIR="$dir/run" XDG_CONFIG_HOME="$dir/config" XDG_STATE_HOME="$dir/state" WD_STUB_DIR="$dir/stub"
+mkdir -m 700 "$XDG_RUNTIME_DIR"
+mkdir -p "$XDG_CONFIG_HOME/waypipe-daemon" "$XDG_STATE_HOME" "$WD_STUB_DIR"
+config="$XDG_CONFIG_HOME/waypipe-daemon/config"
+daemon_log="$dir/daemon.log"
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Usage: launch-policies.sh WDCLIENT STUB_WAYPIPE
+#
+# Launches a single-instance and a reuse-recent application twice each
+# through a private daemon, then checks that each second launch was answered
+# without starting anything, and that a launch after the reuse window starts
+# a new instance.
+set -eu
+wdclient=$1
+stub=$2
+
+. "$(dirname "$0")/common.sh"
+
+cat > "$config" <<CONFIG
+[daemon]
+waypipe = $stub
+prefetch = 0
+
+[app single]
+match = sleep 4.1
+launch = single-instance
+
+[app recent]
+match = sleep 4.2
+launch = reuse-recent
+reuse_window = 1
+CONFIG
+
+start_daemon "$wdclient"
+"$wdclient" sleep 4.1
+"$wdclient" sleep 4.1
+[ "$(stat processes)" -eq 1 ] || fail "single-instance launched twice"
+grep -q 'single is already running' "$daemon_log" || fail "no single-instance no-op in the daemon log"
+
+"$wdclient" sleep 4.2
+"$wdclient" sleep 4.2
+[ "$(stat processes)" -eq 2 ] || fail "reuse-recent launched twice within its window"
+grep -q 'recent is already running' "$daemon_log" || fail "no reuse-recent no-op in the daemon log"
+
+sleep 1.1
+"$wdclient" sleep 4.2
+[ "$(stat processes)" -eq 3 ] || fail "reuse-recent not launched again after its window"
+echo "second launches were no-ops, the reuse window expired"
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Usage: profiles.sh WDCLIENT STUB_WAYPIPE
+#
+# Launches two applications sharing a transport profile and one with another
+# profile through a private daemon, then checks that exactly two waypipe
+# sessions were started, each with the flags of its profile.
+set -eu
+wdclient=$1
+stub=$2
+
+. "$(dirname "$0")/common.sh"
+
+cat > "$config" <<CONFIG
+[daemon]
+waypipe = $stub
+prefetch = 0
+
+[profile video]
+compression = lz4
+video = h264
+threads = 2
+
+[profile text]
+compression = zstd=5
+
+[app first]
+exec = sleep
+profile = video
+
+[app second]
+exec = env
+profile = video
+
+[app third]
+exec = true
+profile = text
+CONFIG
+
+"$wdclient" sleep 1
+track_daemon "$wdclient"
+"$wdclient" env sleep 1
+"$wdclient" true
+
+sessions=$(ls "$WD_STUB_DIR" | wc -l)
+[ "$sessions" -eq 2 ] || fail "expected 2 waypipe sessions, got $sessions"
+
+# Arguments before --display: the profile's flags, in order
+check_flags() {
+    args=$(grep -l -x -- "$1" "$WD_STUB_DIR"/*.args) || fail "no session started with $1"
+    flags=$(sed '/^--display$/,$d' "$args" | tr '\n' ' ')
+    [ "$flags" = "$2 " ] || fail "session flags '$flags', expected '$2'"
+    tail -n 4 "$args" | tr '\n' ' ' | grep -q -x -- 'server -- sleep infinity ' || fail "bad command in $args"
+}
+check_flags --compress=lz4 "--compress=lz4 --video=h264 --threads=2"
+check_flags --compress=zstd=5 "--compress=zstd=5"
+echo "2 sessions with the expected flags"
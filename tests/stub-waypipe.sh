@@ -0,0 +1,15 @@
+#!/bin/sh
+# Stand-in for waypipe in the tests: records its arguments, one per line, in
+# $WD_STUB_DIR/<display>.args, creates the display and runs the keep-alive
+# command of the session.
+set -eu
+display=
+for arg in "$@"; do
+    if [ "$display" = "-" ]; then display=$arg; fi
+    if [ "$arg" = "--display" ]; then display=-; fi
+done
+printf '%s\n' "$@" > "$WD_STUB_DIR/$display.args"
+: > "$XDG_RUNTIME_DIR/$display"
+while [ "$#" -gt 0 ] && [ "$1" != "--" ]; do shift; done
+shift
+exec "$@"
@@ -0,0 +1,117 @@
+/**
+ * @file syscall-count.c
+ * @brief Count the system calls a command makes, failing above a budget
+ *
+ * Usage: syscall-count [--max N] COMMAND [ARG...]
+ *
+ * The command runs under ptrace. System calls are counted from its execve()
+ * on, so the count covers the dynamic loader and the program itself but
+ * none of the tracer's own setup. Children of the command are not followed.
+ * Exits with failure if the command fails or goes over the budget.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+/**
+ * Run the command to its end, returning its wait status or -1.
+ */
+static int trace_command(char *argv[], unsigned long *count) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0) {
+            perror("ptrace");
+            _exit(127);
+        }
+        // Let the tracer set its options before the exec
+        raise(SIGSTOP);
+        execvp(argv[0], argv);
+        perror("execvp");
+        _exit(127);
+    }
+
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status)) {
+        perror("waitpid");
+        return -1;
+    }
+    if (ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC |
+                                                      PTRACE_O_EXITKILL)) < 0) {
+        perror("ptrace");
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    bool execed = false;
+    bool in_syscall = false;
+    int signal_to_deliver = 0;
+    *count = 0;
+    for (;;) {
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)signal_to_deliver) < 0) {
+            perror("ptrace");
+            return -1;
+        }
+        signal_to_deliver = 0;
+        if (waitpid(pid, &status, 0) < 0) {
+            if (errno == EINTR) continue;
+            perror("waitpid");
+            return -1;
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status)) return status;
+        if (!WIFSTOPPED(status)) continue;
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+            // Stops alternate between entering and leaving a system call
+            in_syscall = !in_syscall;
+            if (in_syscall && execed) (*count)++;
+        } else if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXEC << 8))) {
+            // Between the entry and the exit of execve(): start counting with the next call
+            execed = true;
+        } else if (WSTOPSIG(status) != SIGSTOP || execed) {
+            signal_to_deliver = WSTOPSIG(status);
+        }
+    }
+}
+
+int main(const int argc, char *argv[]) {
+    unsigned long max = 0;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "--max") == 0) {
+        char *end = NULL;
+        max = strtoul(argv[2], &end, 10);
+        if (*end != '\0') {
+            fprintf(stderr, "Invalid budget: %s\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        first = 3;
+    }
+    if (first >= argc) {
+        fprintf(stderr, "Usage: %s [--max N] COMMAND [ARG...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    unsigned long count = 0;
+    const int status = trace_command(&argv[first], &count);
+    if (status < 0) return EXIT_FAILURE;
+    printf("%s: %lu system calls\n", argv[first], count);
+    fflush(stdout);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        fprintf(stderr, "%s failed\n", argv[first]);
+        return EXIT_FAILURE;
+    }
+    if (max > 0 && count > max) {
+        fprintf(stderr, "%s made %lu system calls, the budget is %lu\n", argv[first], count, max);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+#!/bin/sh
+# Usage: upgrade-reload.sh WDCLIENT STUB_WAYPIPE
+#
+# Launches an application through a private daemon and upgrades the daemon,
+# then checks that the same process kept the socket, the session and the
+# supervision of the application, and that a warm launch still succeeds.
+# Finally adds a rule to the configuration and checks that it applies
+# without a restart.
+set -eu
+wdclient=$1
+stub=$2
+
+. "$(dirname "$0")/common.sh"
+
+cat > "$config" <<CONFIG
+[daemon]
+waypipe = $stub
+prefetch = 0
+CONFIG
+
+# Usage: wait_for COMMAND...
+wait_for() {
+    tries=0
+    until "$@"; do
+        tries=$((tries + 1))
+        [ "$tries" -lt 50 ] || fail "timed out waiting for: $*"
+        sleep 0.1
+    done
+}
+
+start_daemon "$wdclient"
+"$wdclient" sleep 4.3
+app_pid=$(sed -n 's/.*Launched "sleep 4.3" as pid \([0-9]*\).*/\1/p' "$daemon_log")
+[ -n "$app_pid" ] || fail "no launch in the daemon log"
+
+"$wdclient" --upgrade || fail "upgrade failed"
+grep -q 'Restored 1 session(s) and 1 process(es)' "$daemon_log" || fail "state not restored"
+[ "$(stat pid)" -eq "$daemon_pid" ] || fail "the daemon changed PID"
+[ "$(stat processes)" -eq 1 ] || fail "the application is no longer registered"
+
+"$wdclient" true || fail "warm launch failed after the upgrade"
+[ "$(ls "$WD_STUB_DIR" | wc -l)" -eq 1 ] || fail "the waypipe session was not reused"
+
+# Still supervised: the new executable reaps the application
+kill "$app_pid"
+wait_for grep -q "Process $app_pid (sleep 4.3) killed by signal" "$daemon_log"
+[ "$(stat processes)" -eq 0 ] || fail "the application is still registered"
+[ ! -e "/proc/$app_pid" ] || fail "the application was not reaped"
+
+cat >> "$config" <<CONFIG
+
+[app reloaded]
+match = sleep 4.4
+launch = single-instance
+CONFIG
+wait_for grep -q 'Configuration reloaded' "$daemon_log"
+[ "$(stat rules)" -eq 1 ] || fail "the new rule was not loaded"
+"$wdclient" sleep 4.4
+"$wdclient" sleep 4.4
+grep -q 'reloaded is already running' "$daemon_log" || fail "the new rule didn't apply"
+[ "$(stat processes)" -eq 1 ] || fail "single-instance launched twice"
+[ "$(stat pid)" -eq "$daemon_pid" ] || fail "the daemon restarted"
+echo "upgraded with the application supervised and the session kept, reloaded the rules"
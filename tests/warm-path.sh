@@ -0,0 +1,22 @@
+#!/bin/sh
+# Usage: warm-path.sh WDCLIENT STUB_WAYPIPE SYSCALL_COUNT BUDGET
+#
+# Starts a private daemon and its waypipe session with a first launch, then
+# counts the system calls of a warm launch and fails above the budget.
+set -eu
+wdclient=$1
+stub=$2
+syscall_count=$3
+budget=$4
+
+. "$(dirname "$0")/common.sh"
+
+cat > "$config" <<CONFIG
+[daemon]
+waypipe = $stub
+prefetch = 0
+CONFIG
+
+"$wdclient" true
+track_daemon "$wdclient"
+"$syscall_count" --max "$budget" "$wdclient" true